@@ -0,0 +1,115 @@
+#pragma once
+
+#include <byte-order.h>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// On-disk layout of the bundle header and resource entries. Records are read
+// and written as whole blocks, then converted between the platform's byte
+// order and native order in place, as described by each record's fields.
+class BundleLayout
+{
+public:
+	struct Field
+	{
+		size_t offset;
+		size_t size; // Of one value
+		size_t count;
+	};
+
+	struct HeaderRecord
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t platform;
+		uint32_t debugData;
+		uint32_t resourceCount;
+		uint32_t resourceEntries;
+		uint32_t resourceData[3];
+		uint32_t flags;
+		uint8_t padding[8];
+	};
+
+	struct EntryRecord
+	{
+		uint64_t id;
+		uint64_t importsHash;
+		uint32_t uncompressedInfo[3];
+		uint32_t compressedSize[3];
+		uint32_t offset[3];
+		uint32_t importsOffset;
+		uint32_t type;
+		uint16_t importCount;
+		uint8_t flags;
+		uint8_t stream;
+	};
+
+	// Everything after the magic is one run of 32-bit values
+	static constexpr std::array<Field, 1> headerFields = { {
+		{ 0x04, 4, 9 }
+	} };
+
+	static constexpr std::array<Field, 4> entryFields = { {
+		{ 0x00, 8, 2 }, // id, importsHash
+		{ 0x10, 4, 11 }, // uncompressedInfo through type
+		{ 0x3C, 2, 1 }, // importCount
+		{ 0x3E, 1, 2 } // flags, stream
+	} };
+
+	static constexpr size_t headerSize = 0x30;
+	static constexpr size_t entrySize = 0x40;
+
+	static_assert(sizeof(HeaderRecord) == headerSize);
+	static_assert(offsetof(HeaderRecord, version) == 0x04);
+	static_assert(offsetof(HeaderRecord, flags) == 0x04 + 8 * 4);
+	static_assert(sizeof(EntryRecord) == entrySize);
+	static_assert(offsetof(EntryRecord, uncompressedInfo) == 0x10);
+	static_assert(offsetof(EntryRecord, type) == 0x10 + 10 * 4);
+	static_assert(offsetof(EntryRecord, importCount) == 0x3C);
+	static_assert(offsetof(EntryRecord, flags) == 0x3E);
+
+	template<std::endian Order, size_t Size>
+	static void convertRun(unsigned char* data, size_t count)
+	{
+		if constexpr (Size == 2)
+			ByteOrder::convert<Order>((uint16_t*)data, count);
+		else if constexpr (Size == 4)
+			ByteOrder::convert<Order>((uint32_t*)data, count);
+		else if constexpr (Size == 8)
+			ByteOrder::convert<Order>((uint64_t*)data, count);
+	}
+
+	// Converts records between disk and native order. The conversion is its
+	// own inverse, so this is used for both reading and writing.
+	template<std::endian Order, typename Record, size_t FieldCount>
+	static void convert(Record* records, size_t count, const std::array<Field, FieldCount>& fields)
+	{
+		if constexpr (Order == std::endian::native)
+			return;
+		for (size_t i = 0; i < count; ++i)
+		{
+			unsigned char* record = (unsigned char*)&records[i];
+			for (const Field& field : fields)
+			{
+				if (field.size == 2)
+					convertRun<Order, 2>(record + field.offset, field.count);
+				else if (field.size == 4)
+					convertRun<Order, 4>(record + field.offset, field.count);
+				else if (field.size == 8)
+					convertRun<Order, 8>(record + field.offset, field.count);
+			}
+		}
+	}
+
+	template<typename Record, size_t FieldCount>
+	static void convert(bool bigEndian, Record* records, size_t count, const std::array<Field, FieldCount>& fields)
+	{
+		if (bigEndian)
+			convert<std::endian::big>(records, count, fields);
+		else
+			convert<std::endian::little>(records, count, fields);
+	}
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+// Unaligned loads and stores of integers in a byte order fixed at compile
+// time, for code that converts whole tables at once rather than a field at a
+// time through GameDataStream.
+class ByteOrder
+{
+public:
+	template<typename T>
+	static constexpr T swap(T value)
+	{
+		static_assert(std::is_unsigned_v<T>);
+		if constexpr (sizeof(T) == 1)
+			return value;
+#if defined(_MSC_VER)
+		else if constexpr (sizeof(T) == 2)
+			return _byteswap_ushort(value);
+		else if constexpr (sizeof(T) == 4)
+			return _byteswap_ulong(value);
+		else
+			return _byteswap_uint64(value);
+#else
+		else if constexpr (sizeof(T) == 2)
+			return __builtin_bswap16(value);
+		else if constexpr (sizeof(T) == 4)
+			return __builtin_bswap32(value);
+		else
+			return __builtin_bswap64(value);
+#endif
+	}
+
+	template<std::endian Order, typename T>
+	static T load(const void* data)
+	{
+		T value;
+		std::memcpy(&value, data, sizeof(T));
+		if constexpr (Order != std::endian::native)
+			value = swap(value);
+		return value;
+	}
+
+	template<std::endian Order, typename T>
+	static void store(void* data, T value)
+	{
+		if constexpr (Order != std::endian::native)
+			value = swap(value);
+		std::memcpy(data, &value, sizeof(T));
+	}
+
+	// Converts an array of integers in place. Written as a plain loop so it
+	// vectorizes.
+	template<std::endian Order, typename T>
+	static void convert(T* data, size_t count)
+	{
+		if constexpr (Order != std::endian::native)
+		{
+			for (size_t i = 0; i < count; ++i)
+				data[i] = swap(data[i]);
+		}
+	}
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <byte-order.h>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+// Converts import tables between memory and their on-disk form: 0x10-byte
+// records holding a 64-bit ID, a 32-bit offset, and 4 bytes of padding, in
+// the platform's byte order. PC is little endian, X360 and PS3 big endian.
+// Entry is any type with id and offset members.
+template<std::endian Order>
+class ImportCodec
+{
+public:
+	static constexpr int recordSize = 0x10;
+
+	template<typename Entry>
+	static void decode(const unsigned char* data, Entry* entries, int count)
+	{
+		for (int i = 0; i < count; ++i, data += recordSize)
+		{
+			entries[i].id = ByteOrder::load<Order, uint64_t>(data);
+			entries[i].offset = ByteOrder::load<Order, uint32_t>(data + 8);
+		}
+	}
+
+	template<typename Entry>
+	static void encode(const Entry* entries, int count, unsigned char* data)
+	{
+		for (int i = 0; i < count; ++i, data += recordSize)
+		{
+			ByteOrder::store<Order, uint64_t>(data, entries[i].id);
+			ByteOrder::store<Order, uint32_t>(data + 8, entries[i].offset);
+			std::memset(data + 12, 0, 4);
+		}
+	}
+};
+
+// The codec for a bundle's platform, picked once per table
+template<typename Entry>
+inline void decodeImports(bool bigEndian, const unsigned char* data, Entry* entries, int count)
+{
+	if (bigEndian)
+		ImportCodec<std::endian::big>::decode(data, entries, count);
+	else
+		ImportCodec<std::endian::little>::decode(data, entries, count);
+}
+
+template<typename Entry>
+inline void encodeImports(bool bigEndian, const Entry* entries, int count, unsigned char* data)
+{
+	if (bigEndian)
+		ImportCodec<std::endian::big>::encode(entries, count, data);
+	else
+		ImportCodec<std::endian::little>::encode(entries, count, data);
+}
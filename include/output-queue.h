@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QSet>
+#include <QString>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+class TarWriter;
+
+// Writes files on a pool of background threads so producers never wait on
+// the filesystem, other than when too much data is waiting to be written.
+// Files can instead be written to a tar archive on a single thread. In that
+// case, files are written in group order so the archive is always the same,
+// and ungrouped files must only be written once every group is closed.
+class OutputQueue
+{
+public:
+	OutputQueue(int threadCount, qint64 maxPendingBytes);
+	OutputQueue(QIODevice* archive, qint64 modifiedTime, qint64 maxPendingBytes);
+	~OutputQueue();
+
+	// Data is not copied. Raw data (e.g. a mapped bundle) must outlive finish().
+	void write(const QString& path, QByteArray data, int group = -1);
+	// A buffer from a finished write, keeping its capacity, or an empty one
+	QByteArray takeBuffer();
+	void closeGroup(int group);
+	void finish();
+
+private:
+	struct Job
+	{
+		QString path;
+		QByteArray data;
+	};
+
+	std::vector<std::thread> threads;
+	std::deque<Job> jobs;
+	std::mutex mutex;
+	std::condition_variable jobAdded;
+	std::condition_variable jobDone;
+	qint64 pendingBytes = 0;
+	qint64 maxPendingBytes = 0;
+	bool finishing = false;
+	std::vector<QByteArray> freeBuffers;
+
+	TarWriter* tar = nullptr;
+	std::map<int, std::vector<Job>> groupedJobs; // Waiting on earlier groups
+	std::set<int> closedGroups;
+	int nextGroup = 0;
+
+	QSet<QString> createdDirectories;
+	std::mutex directoryMutex;
+
+	void run();
+	void ensureDirectory(const QString& path);
+};
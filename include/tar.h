@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QString>
+#include <cstdint>
+
+// Minimal ustar support, enough to store an extracted bundle in a single
+// stream and read it back. Only regular files are written or read.
+class TarWriter
+{
+public:
+	TarWriter(QIODevice* device, qint64 modifiedTime);
+
+	bool addFile(const QString& path, const QByteArray& data);
+	bool finish();
+
+private:
+	QIODevice* device = nullptr;
+	qint64 modifiedTime = 0;
+};
+
+class TarReader
+{
+public:
+	// Files are keyed by prefix + their path in the archive and point into
+	// archive, which must outlive them.
+	static bool read(const QByteArray& archive, const QString& prefix, QHash<QString, QByteArray>& files);
+};
@@ -2,16 +2,24 @@
 #include <gamedata-stream.h>
 #include <libdeflate.h>
 #include <yaml-cpp/yaml.h>
+#include <QByteArray>
 #include <QDateTime>
 #include <QLocale>
 #include <QDebug>
+#include <QHash>
 #include <QList>
 #include <QMap>
+#include <QSet>
 #include <QString>
 #include <QStringList>
+#include <QTextStream>
 #include <cstdint>
+#include <functional>
 #include <string>
 
+class OutputQueue;
+class QFile;
+
 class YAP
 {
 public:
@@ -64,6 +72,96 @@ private:
 		QList<ResourceEntry> entries;
 	};
 
+	// Per-thread state for extraction, reused for every resource
+	struct ExtractWorker
+	{
+		GameDataStream* stream = nullptr; // Only used if the bundle isn't mapped
+		libdeflate_decompressor* decompressor = nullptr;
+		QByteArray readBuffer[3]; // Data by memory type, if the bundle isn't mapped
+		bool readAhead[3] = {}; // Read while indexing, so extraction needn't read again
+	};
+
+	// Per-thread state for creation. Compressors are made as each level is
+	// first needed.
+	struct CreateWorker
+	{
+		libdeflate_compressor* compressors[13] = {};
+		uint32_t cacheHits = 0;
+		bool parallelLevels = false; // Try a profile's levels at once, not one by one
+	};
+
+	// What was extracted from a resource, kept in the index so unchanged
+	// resources can be skipped when extracting to the same folder again
+	struct IndexEntry
+	{
+		uint64_t id = 0;
+		uint32_t type = 0;
+		uint32_t uncompressedInfo[3] = { 0, 0, 0 };
+		uint32_t compressedSize[3] = { 0, 0, 0 };
+		uint64_t dataHash[3] = { 0, 0, 0 }; // Of the data as stored in the bundle
+		QList<ImportEntry> imports;
+		QStringList files; // Relative to the output folder
+		QList<qint64> fileSizes;
+		QList<qint64> fileTimes; // ms since epoch, only when read from disk
+		bool unchanged = false;
+	};
+
+	// Bundle-wide part of the index
+	struct IndexHeader
+	{
+		uint32_t platform = 0;
+		uint32_t flags = 0;
+		bool combinedImports = false;
+		int64_t metadataSize = 0;
+		int64_t metadataTime = 0;
+		int64_t importsSize = 0;
+		int64_t importsTime = 0;
+	};
+
+	// Totals for one resource type when verifying
+	struct VerifyStats
+	{
+		uint32_t count = 0;
+		uint32_t failures = 0;
+		uint64_t compressedSize = 0;
+		uint64_t uncompressedSize = 0;
+	};
+
+	// One resource as described by the metadata file, read once when validating
+	struct ResourceDescriptor
+	{
+		uint64_t id = 0;
+		uint32_t type = 0;
+		int secondaryMemoryType = -1; // -1=none
+		uint16_t alignment[2] = { 0, 0 }; // Primary, secondary; 0=default
+	};
+
+	// Data and imports files found for one resource ID when creating
+	struct InputFiles
+	{
+		QStringList primary; // <ID>.dat or <ID>_header.dat, more than one is a duplicate
+		QStringList secondary; // <ID>_body.dat
+		QStringList imports; // <ID>_imports.yaml
+	};
+
+	// One extract or create run in batch mode
+	struct BatchJob
+	{
+		QString mode;
+		QString inPath;
+		QString outPath;
+		bool doNotSortByType = false;
+		bool combineImports = false;
+		bool incremental = false;
+		bool salvage = false;
+		int result = -1; // -1=not run
+		QString error; // What was thrown, if the job ended in an exception
+		qint64 elapsed = 0; // ms
+	};
+
+	YAP(const YAP& batch, const BatchJob& job, libdeflate_decompressor* decompressor,
+		libdeflate_compressor* compressor);
+
 	const std::string version = "0.1";
 	const std::string date = QLocale("en_US").toDate(QString(__DATE__).simplified(), "MMM d yyyy").toString(Qt::ISODate).first(10).toStdString();
 	QString mode;
@@ -71,57 +169,158 @@ private:
 	QString outPath;
 	bool doNotSortByType = false;
 	bool combineImports = false;
+	bool incremental = false;
+	bool salvage = false;
+	QString archivePath; // Tar archive to extract to, - for stdout
+	bool inputIsArchive = false; // Creating from a tar archive
+	QByteArray inputArchive;
+	QHash<QString, QByteArray> archiveFiles; // inPath + path in archive, data points into inputArchive
+	QString listFormat = "text"; // text, json, csv
+	uint32_t jobs = 0; // 0=one per hardware thread
+	int compressionLevel = 9; // Of the profile, or the first tried
+	QString compressionProfile = "default"; // fast, default, ship
+	QMap<QString, int> typeLevelStrings; // Resolved once the platform is known
+	QHash<uint32_t, int> typeLevels;
+	bool estimate = false;
+	QString cachePath; // Compressed portion cache, empty if unused
+	QString dedupMode; // copy or share, empty if not deduplicating
+	QList<qsizetype> duplicateOf; // Per portion being written, the first with the same data, or -1
+	uint64_t duplicateBytes = 0; // Uncompressed
+	QSet<uint64_t> selectedIds; // Empty=all
+	QStringList selectedTypeStrings; // Numbers or names, resolved once the platform is known
+	bool selectedMemoryTypes[3] = { true, true, true };
 	uint16_t defaultPrimaryAlignment = 0x10;
 	uint16_t defaultSecondaryAlignment = 0x80;
 	argparse::ArgumentParser* args = nullptr;
 	libdeflate_decompressor* dc = nullptr;
 	libdeflate_compressor* cmp = nullptr;
+	bool sharedCodecs = false; // dc and cmp belong to a batch thread
+	uchar* mappedBundle = nullptr; // Whole input bundle when extracting, if it could be mapped
+	qint64 mappedBundleSize = 0;
+	OutputQueue* output = nullptr; // Write-behind file output when extracting
 	const QString debugDataFilename = ".debug.xml";
 	const QString importsFilename = ".imports.yaml";
 	const QString metadataFilename = ".meta.yaml";
+	const QString indexFilename = ".index.bin";
+	const uint32_t indexVersion = 2;
 	const QString defaultSuffix = ".dat";
 	const QString primarySuffix = "_header.dat";
 	const QString secondarySuffix = "_body.dat";
 	const QString importsSuffix = "_imports.yaml";
 	QList<QStringList> resourceFiles; // [0]=primary, [1]=secondary, [2]=imports
-	YAML::Node combinedImports;
+	QHash<uint64_t, QList<ImportEntry>> importTable; // By resource ID, read once when validating
+	QHash<uint64_t, InputFiles> inputFiles; // By resource ID, from one walk of the input
+	QHash<QString, qint64> inputSizes; // Of the files in inputFiles, kept for creation
+	QHash<uint64_t, IndexEntry> previousIndex;
+	QList<IndexEntry> extractIndex; // Per bundle entry
+	IndexHeader indexHeader; // Bundle-wide settings when creating, from the index or metadata
+	QList<ResourceDescriptor> resourceDescriptors; // From the metadata, in file order
+	QList<IndexEntry> indexedResources; // Empty if the metadata must be parsed
 
 	void setupArgs();
 	bool readArgs(int argc, char* argv[]);
+	void preparePaths(bool tar);
 	bool validateArgs();
 	bool validateExtractArgs();
 	bool validateCreateArgs();
+	bool validateListArgs();
+	bool validateBatchArgs();
+	bool validateVerifyArgs();
+	bool validatePatchArgs();
+	bool readInputArchive();
+	bool inputExists(const QString& path);
+	bool inputReadable(const QString& path);
+	qint64 inputSize(const QString& path);
+	QByteArray readInput(const QString& path);
+	YAML::Node loadInputYaml(const QString& path);
+	void indexInputFiles();
+	bool addInputFile(QHash<uint64_t, InputFiles>& index, const QString& path);
 	bool validateMetadata();
 	bool validateBundleMetadata(YAML::Node& meta);
 	bool validateResourceMetadata(YAML::Node& meta);
-	bool validateImports(YAML::Node& meta);
+	bool validateImports();
+	bool parseImports(const YAML::Node& resourceImports, const std::string& resourceKey, QList<ImportEntry>& imports);
+	bool scanImports(const QByteArray& text, QList<ImportEntry>& imports);
+	bool scanCombinedImports(const QByteArray& text, QHash<uint64_t, QList<ImportEntry>>& lists);
 	bool validateResourceIdKey(std::string resourceKey, uint64_t& id);
 	//bool resourceHasDuplicateKey(YAML::Node list, uint64_t id, std::string resourceKey);
 	//bool importHasDuplicateKey(YAML::Node list, uint32_t offset, std::string importKey);
 	void setShaderTypeName(GameDataStream& stream);
+	bool resolveTypeString(const QString& typeString, QList<uint32_t>& types);
 	void createDecompressor();
 	void createCompressor();
 
 	int extract();
 	bool validateBundle(GameDataStream& stream);
 	void readBundle(GameDataStream& stream, Bundle& bundle);
-	void readResourceEntry(GameDataStream& stream, Bundle& bundle, int index);
-	bool validateResourceEntries(Bundle& bundle);
-	void extractResource(GameDataStream& stream, Bundle& bundle, int index);
+	bool validateResourceEntries(Bundle& bundle, uint32_t* validCount = nullptr);
+	bool selectResources(Bundle& bundle, QList<uint32_t>& selection);
+	void extractResources(GameDataStream& stream, Bundle& bundle, const QList<uint32_t>& selection);
+	void extractResource(ExtractWorker& worker, Bundle& bundle, int index, int group);
+	uint32_t readImports(Bundle& bundle, ResourceEntry& entry, const QByteArray& resource);
 	QString generateFilePath(ResourceEntry& entry, int memType);
-	void outputResource(char* resource, int length, QString path);
-	void outputImports(Bundle& bundle, int resIndex);
+	QString generateImportsPath(ResourceEntry& entry);
+	void outputResource(QByteArray resource, QString path, int group);
+	void outputImports(Bundle& bundle, int resIndex, int group);
+	void appendImports(QByteArray& out, const ResourceEntry& resEntry);
 	void outputDebugData(GameDataStream& stream, Bundle& bundle);
-	void outputMetadata(Bundle& bundle);
+	void outputMetadata(Bundle& bundle, const QList<uint32_t>& selection);
+	void salvageResources(QFile& file, Bundle& bundle, uint32_t validCount,
+		const QList<uint32_t>& untrusted, QList<uint32_t>& selection);
+	bool loadIndex(const QString& path, IndexHeader& header, QList<IndexEntry>& entries);
+	void readIndex();
+	void writeIndex(Bundle& bundle, const QList<uint32_t>& selection);
+	bool indexResource(ExtractWorker& worker, Bundle& bundle, int index);
+	uint64_t hashPortion(ExtractWorker& worker, Bundle& bundle, ResourceEntry& entry, int memType);
+	void removeStaleFiles(const QList<uint32_t>& selection);
+	bool readCreateIndex();
+
+	int list();
+	void listBundle(QTextStream& out, const QString& path, Bundle& bundle, bool first);
+
+	int verify();
+	bool verifyResource(ExtractWorker& worker, Bundle& bundle, const ResourceEntry& entry,
+		QByteArray& scratch, VerifyStats& stats);
+	bool verifyImports(Bundle& bundle, const ResourceEntry& entry, const uchar* resource, uint32_t size);
+
+	int batch();
+	bool readBatchManifest(QList<BatchJob>& jobList);
+	void findBatchBundles(QList<BatchJob>& jobList);
 
 	int create();
-	void createBundle(GameDataStream& stream, YAML::Node& meta, Bundle& bundle);
+	void createBundle(GameDataStream& stream, Bundle& bundle);
 	void setPlatform(GameDataStream& stream, Bundle bundle);
-	void createResourceEntry(YAML::const_iterator& resource, Bundle& bundle, int index);
+	void layoutBundle(Bundle& bundle);
+	void createResourceEntry(Bundle& bundle, int index);
+	void createIndexedResourceEntry(Bundle& bundle, int index);
 	static bool compareResourceEntry(const ResourceEntry& a, const ResourceEntry& b);
-	static bool compareResourceFileList(const QStringList& a, const QStringList& b);
-	void createResource(QByteArray& data, Bundle& bundle, int index, int memType, GameDataStream::Platform platform);
-	void outputBundle(GameDataStream& stream, Bundle& bundle, QByteArray data[]);
+	void sortResourceEntries(Bundle& bundle);
+	QList<uint32_t> listPortions(Bundle& bundle);
+	bool resolveTypeLevels();
+	QList<int> compressionLevels(uint32_t type);
+	void createResources(Bundle& bundle, GameDataStream::Platform platform, const QList<uint32_t>& work,
+		const std::function<void(qsizetype position, QByteArray& portion)>& commit);
+	void estimateBundle(Bundle& bundle, GameDataStream::Platform platform, const QList<uint32_t>& work);
+	void findDuplicatePortions(Bundle& bundle, GameDataStream::Platform platform, const QList<uint32_t>& work);
+	QByteArray readPortion(Bundle& bundle, int index, int memType, GameDataStream::Platform platform);
+	QByteArray createResource(CreateWorker& worker, Bundle& bundle, int index, int memType, GameDataStream::Platform platform);
+	QByteArray compressPortion(CreateWorker& worker, uint32_t type, const QByteArray& data);
+	QByteArray cacheKey(const QByteArray& data, const QList<int>& levels);
+	QString cacheFilePath(const QByteArray& key);
+	QByteArray readCache(const QByteArray& key);
+	void writeCache(const QByteArray& key, const QByteArray& data);
+	void outputBundle(GameDataStream& stream, Bundle& bundle, const QList<uint32_t>& work);
+	void writeBundleHeader(GameDataStream& stream, Bundle& bundle);
+	void writeResourceEntries(GameDataStream& stream, Bundle& bundle, uint32_t first, uint32_t count);
+
+	int patch();
+	bool readCombinedPatchImports(QHash<uint64_t, QList<ImportEntry>>& lists);
+	bool preparePatch(GameDataStream& stream, Bundle& bundle, CreateWorker& worker, ResourceEntry& patched,
+		const InputFiles& files, const QHash<uint64_t, QList<ImportEntry>>* combinedImports,
+		QList<QByteArray>& portions);
+	QByteArray readBundlePortion(GameDataStream& stream, Bundle& bundle, const ResourceEntry& entry, int memType);
+	void placePortion(GameDataStream& stream, Bundle& bundle, uint32_t index, int memType, const QByteArray& portion);
+	void shiftMemoryTypes(GameDataStream& stream, Bundle& bundle, int first, uint32_t distance);
 
 	// Don't particularly like this but it lets people use hex
 	template<typename T, class = typename std::enable_if_t<std::is_unsigned_v<T>>>
@@ -0,0 +1,245 @@
+#include <yap.h>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// Swallows the progress output of jobs, which would otherwise interleave
+	class NullBuffer : public std::streambuf
+	{
+	protected:
+		int overflow(int c) override { return c; }
+	};
+}
+
+// Runs a batch job with the settings of the batch it belongs to, skipping
+// argument parsing and using the calling thread's (de)compressor
+YAP::YAP(const YAP& batch, const BatchJob& job, libdeflate_decompressor* decompressor,
+	libdeflate_compressor* compressor)
+	: date(batch.date), resourceTypes(batch.resourceTypes)
+{
+	mode = job.mode;
+	inPath = job.inPath;
+	outPath = job.outPath;
+	doNotSortByType = job.doNotSortByType || batch.doNotSortByType;
+	combineImports = job.combineImports || batch.combineImports;
+	incremental = job.incremental || batch.incremental;
+	salvage = job.salvage || batch.salvage;
+	jobs = 1; // Jobs are the unit of parallelism
+	compressionLevel = batch.compressionLevel;
+	compressionProfile = batch.compressionProfile;
+	typeLevelStrings = batch.typeLevelStrings;
+	cachePath = batch.cachePath;
+	dedupMode = batch.dedupMode;
+	selectedIds = batch.selectedIds;
+	selectedTypeStrings = batch.selectedTypeStrings;
+	for (int i = 0; i < 3; ++i)
+		selectedMemoryTypes[i] = batch.selectedMemoryTypes[i];
+	defaultPrimaryAlignment = batch.defaultPrimaryAlignment;
+	defaultSecondaryAlignment = batch.defaultSecondaryAlignment;
+	dc = decompressor;
+	cmp = compressor;
+	sharedCodecs = true;
+
+	preparePaths(false);
+	if (!validateArgs())
+	{
+		result = 1;
+		return;
+	}
+
+	if (mode == "e")
+		result = extract();
+	else if (mode == "c")
+		result = create();
+}
+
+int YAP::batch()
+{
+	QList<BatchJob> jobList;
+	if (QFileInfo(inPath).isDir())
+		findBatchBundles(jobList);
+	else if (!readBatchManifest(jobList))
+		return 2;
+	if (jobList.isEmpty())
+	{
+		qWarning() << "No jobs to run.";
+		return 0;
+	}
+
+	std::cout << "Running " << jobList.size() << " jobs\n";
+	std::streambuf* console = std::cout.rdbuf();
+	std::ostream progress(console);
+	NullBuffer nullBuffer;
+	std::cout.rdbuf(&nullBuffer);
+
+	std::atomic<qsizetype> nextJob = 0;
+	std::mutex progressMutex;
+	int finishedCount = 0;
+	auto runJobs = [&]()
+	{
+		// Reused for every job this thread runs
+		libdeflate_decompressor* decompressor = libdeflate_alloc_decompressor();
+		libdeflate_compressor* compressor = libdeflate_alloc_compressor(compressionLevel);
+		for (qsizetype i = nextJob++; i < jobList.size(); i = nextJob++)
+		{
+			BatchJob& job = jobList[i];
+			QElapsedTimer timer;
+			timer.start();
+			// A job that throws, such as yaml-cpp on a malformed file, only
+			// fails that job
+			try
+			{
+				YAP runner(*this, job, decompressor, compressor);
+				job.result = runner.result;
+			}
+			catch (const std::exception& e)
+			{
+				job.result = 1;
+				job.error = QString::fromUtf8(e.what());
+			}
+			job.elapsed = timer.elapsed();
+
+			std::lock_guard<std::mutex> lock(progressMutex);
+			progress << "\rFinished job " << ++finishedCount << "/" << jobList.size() << std::flush;
+		}
+		libdeflate_free_decompressor(decompressor);
+		libdeflate_free_compressor(compressor);
+	};
+
+	uint32_t threadCount = std::min<uint32_t>(jobs, jobList.size());
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < threadCount; ++i)
+		threads.emplace_back(runJobs);
+	runJobs();
+	for (std::thread& thread : threads)
+		thread.join();
+	std::cout.rdbuf(console);
+	std::cout << "\n\n";
+
+	int failedCount = 0;
+	for (const BatchJob& job : jobList)
+	{
+		if (job.result != 0)
+			++failedCount;
+		QString status = job.result == 0 ? "OK" : "FAILED (" + QString::number(job.result) + ")";
+		std::cout << status.leftJustified(12).toStdString() << job.mode.toStdString() << ' '
+			<< job.inPath.toStdString() << " -> "
+			<< job.outPath.toStdString()
+			<< " (" << QString::number(job.elapsed / 1000.0, 'f', 2).toStdString() << "s)";
+		if (!job.error.isEmpty())
+			std::cout << ": " << job.error.toStdString();
+		std::cout << '\n';
+	}
+	std::cout << jobList.size() - failedCount << "/" << jobList.size() << " jobs succeeded";
+
+	return failedCount == 0 ? 0 : 2;
+}
+
+// The manifest is a list of jobs:
+// - mode: e
+//   input: AI.DAT
+//   output: ai
+//   nosort: true
+// Relative paths are relative to the manifest
+bool YAP::readBatchManifest(QList<BatchJob>& jobList)
+{
+	YAML::Node manifest;
+	try
+	{
+		manifest = YAML::LoadFile(inPath.toStdString());
+	}
+	catch (const std::exception& e)
+	{
+		qCritical().noquote().nospace() << "Failed to parse batch manifest: " << e.what();
+		return false;
+	}
+	if (!manifest.IsSequence())
+	{
+		qCritical() << "Batch manifest must be a list of jobs.";
+		return false;
+	}
+
+	QDir manifestDir(QFileInfo(inPath).absolutePath());
+	for (size_t i = 0; i < manifest.size(); ++i)
+	{
+		YAML::Node node = manifest[i];
+		if (!node.IsMap() || !node["mode"] || !node["input"] || !node["output"])
+		{
+			qCritical().noquote().nospace() << "Batch job " << i + 1
+				<< " must have a mode, input, and output.";
+			return false;
+		}
+		// Checked before converting, since yaml-cpp throws on the wrong kind
+		// of value
+		auto invalid = [&](const char* key)
+		{
+			qCritical().noquote().nospace() << "Batch job " << i + 1 << " has an invalid " << key << ".";
+			return false;
+		};
+		for (const char* key : { "mode", "input", "output" })
+		{
+			if (!node[key].IsScalar())
+				return invalid(key);
+		}
+		auto readFlag = [&](const char* key, bool& value)
+		{
+			YAML::Node flag = node[key];
+			if (!flag)
+				return true;
+			return (flag.IsScalar() && YAML::convert<bool>::decode(flag, value)) || invalid(key);
+		};
+
+		BatchJob job;
+		job.mode = QString::fromStdString(node["mode"].as<std::string>());
+		if (job.mode != "e" && job.mode != "c")
+		{
+			qCritical().noquote().nospace() << "Batch job " << i + 1
+				<< " has invalid mode " << job.mode << ". Must be e or c.";
+			return false;
+		}
+		job.inPath = manifestDir.filePath(QString::fromStdString(node["input"].as<std::string>()));
+		job.outPath = manifestDir.filePath(QString::fromStdString(node["output"].as<std::string>()));
+		if (!readFlag("nosort", job.doNotSortByType) || !readFlag("combine-imports", job.combineImports)
+			|| !readFlag("incremental", job.incremental) || !readFlag("salvage", job.salvage))
+			return false;
+		jobList.append(job);
+	}
+
+	return true;
+}
+
+// Each bundle in the input folder is extracted to the same relative path in
+// the output folder
+void YAP::findBatchBundles(QList<BatchJob>& jobList)
+{
+	QDir inDir(inPath);
+	QStringList bundlePaths;
+	QDirIterator it(inPath, QDir::Files, QDirIterator::Subdirectories);
+	while (it.hasNext())
+	{
+		QString path = it.next();
+		QFile file(path);
+		if (file.open(QIODeviceBase::ReadOnly) && file.peek(4) == "bnd2")
+			bundlePaths.append(path);
+	}
+	std::sort(bundlePaths.begin(), bundlePaths.end());
+
+	for (const QString& path : bundlePaths)
+	{
+		BatchJob job;
+		job.mode = "e";
+		job.inPath = path;
+		job.outPath = outPath + inDir.relativeFilePath(path);
+		jobList.append(job);
+	}
+}
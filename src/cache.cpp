@@ -0,0 +1,48 @@
+#include <yap.h>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+// Compressed portions are cached by a hash of what was compressed and how, so
+// rebuilding after a small change only compresses what changed. Entries are
+// never invalidated since the key covers everything the output depends on.
+// Layout: <cache>/<first 2 hex digits>/<hash>.z
+
+QByteArray YAP::cacheKey(const QByteArray& data, const QList<int>& levels)
+{
+	QCryptographicHash hash(QCryptographicHash::Blake2b_256);
+	QByteArray settings = "yap-zlib-1:";
+	for (int level : levels)
+		settings += QByteArray::number(level) + ',';
+	hash.addData(settings);
+	hash.addData(data);
+	return hash.result().toHex();
+}
+
+QString YAP::cacheFilePath(const QByteArray& key)
+{
+	return cachePath + QString::fromLatin1(key.first(2)) + '/' + QString::fromLatin1(key) + ".z";
+}
+
+// Returns a null array if the key isn't cached
+QByteArray YAP::readCache(const QByteArray& key)
+{
+	QFile file(cacheFilePath(key));
+	if (!file.open(QIODeviceBase::ReadOnly))
+		return QByteArray();
+	return file.readAll();
+}
+
+void YAP::writeCache(const QByteArray& key, const QByteArray& data)
+{
+	// Written to a temporary file and renamed, so concurrent builds sharing the
+	// cache never see a partial entry
+	QString path = cacheFilePath(key);
+	QDir().mkpath(path.first(path.lastIndexOf('/')));
+	QSaveFile file(path);
+	if (!file.open(QIODeviceBase::WriteOnly))
+		return;
+	file.write(data);
+	file.commit();
+}
@@ -1,66 +1,63 @@
 #include <yap.h>
-#include <QBuffer>
+#include <bundle-layout.h>
+#include <import-codec.h>
 #include <QByteArray>
+#include <QCryptographicHash>
 #include <QDirIterator>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
 
 int YAP::create()
 {
 	QFile file(outPath);
 	GameDataStream stream(&file);
-	YAML::Node meta = YAML::LoadFile((inPath + metadataFilename).toStdString());
 	Bundle bundle;
-	createBundle(stream, meta, bundle);
-	int index = 0;
-	for (YAML::const_iterator resource = meta["resources"].begin();
-		resource != meta["resources"].end(); ++resource, ++index)
-		createResourceEntry(resource, bundle, index);
+	createBundle(stream, bundle);
+	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
+	{
+		if (!indexedResources.isEmpty())
+			createIndexedResourceEntry(bundle, i);
+		else
+			createResourceEntry(bundle, i);
+	}
 	std::cout << '\n';
-	std::sort(bundle.entries.begin(), bundle.entries.end(), compareResourceEntry);
-	std::sort(resourceFiles.begin(), resourceFiles.end(), compareResourceFileList);
+	sortResourceEntries(bundle);
+	setShaderTypeName(stream);
+	if (!resolveTypeLevels())
+		return 2;
 	createCompressor();
-	QByteArray resourceData[3];
-	for (int i = 0; i < 3; ++i)
+	QList<uint32_t> work = listPortions(bundle);
+	if (estimate)
 	{
-		for (uint32_t j = 0; j < bundle.resourceCount; ++j)
-			createResource(resourceData[i], bundle, j, i, stream.platform());
-		if (i == 0)
-		{
-			auto remainder = (bundle.resourceData[0] + resourceData[0].size()) % 0x80;
-			if (remainder != 0)
-				resourceData[0].resize(resourceData[0].size() - remainder + 0x80, '\0');
-		}
-		if (i == 1)
-		{
-			uint64_t total = 0;
-			for (uint32_t j = 0; j < bundle.resourceCount; ++j)
-				total += bundle.entries[j].uncompressedInfo[i + 1] & 0x0FFFFFFF;
-			if (total > 0)
-			{
-				auto remainder = (bundle.resourceData[0] + resourceData[0].size() + resourceData[1].size()) % 0x80;
-				if (remainder != 0)
-					resourceData[1].resize(resourceData[1].size() - remainder + 0x80, '\0');
-			}
-		}
+		estimateBundle(bundle, stream.platform(), work);
+		return 0;
 	}
-	std::cout << '\n';
-	outputBundle(stream, bundle, resourceData);
+	if (!dedupMode.isEmpty())
+		findDuplicatePortions(bundle, stream.platform(), work);
+	outputBundle(stream, bundle, work);
 	return 0;
 }
 
-void YAP::createBundle(GameDataStream& stream, YAML::Node& meta, Bundle& bundle)
+// Places the debug data and resource entries. The resource count must be set.
+void YAP::layoutBundle(Bundle& bundle)
 {
-	bundle.magic = "bnd2";
-	bundle.version = 2;
-	bundle.platform = meta["bundle"]["platform"].as<uint32_t>();
-	setPlatform(stream, bundle);
 	bundle.debugData = 0x30;
-	QFileInfo debugDataInfo(inPath + debugDataFilename);
-	if (debugDataInfo.exists() && debugDataInfo.size() > 0)
+	qint64 debugDataSize = inputExists(inPath + debugDataFilename) ? inputSize(inPath + debugDataFilename) : 0;
+	if (debugDataSize > 0)
 	{
-		uint32_t entriesOffset = bundle.debugData + debugDataInfo.size() + 1;
+		uint32_t entriesOffset = bundle.debugData + debugDataSize + 1;
 		if (entriesOffset % 0x10 != 0)
 			bundle.resourceEntries = (entriesOffset & 0xFFFFFFF0) + 0x10;
 		else
@@ -71,40 +68,23 @@ void YAP::createBundle(GameDataStream& stream, YAML::Node& meta, Bundle& bundle)
 	{
 		bundle.resourceEntries = bundle.debugData;
 	}
-	bundle.resourceCount = meta["resources"].size();
-	if (bundle.resourceCount == 0)
-		qWarning() << "Metadata file contains no resources.";
 	bundle.resourceData[0] = bundle.resourceEntries + bundle.resourceCount * 0x40;
 	// resourceData[1] and [2] set after writing resources
+}
 
-	// Set flags other than debug data flag
-	if (!meta["bundle"]["compressed"] || !meta["bundle"]["compressed"].IsScalar())
-	{
-		qWarning() << "Flag \"compressed\" is unspecified or invalid. Defaulting to true.";
-		bundle.flags |= (uint32_t)Bundle::Flags::IsCompressed;
-	}
-	else if (meta["bundle"]["compressed"].as<bool>())
-	{
-		bundle.flags |= (uint32_t)Bundle::Flags::IsCompressed;
-	}
-	if (!meta["bundle"]["mainMemOptimised"] || !meta["bundle"]["mainMemOptimised"].IsScalar())
-	{
-		qWarning() << "Flag \"mainMemOptimised\" is unspecified or invalid. Defaulting to true.";
-		bundle.flags |= (uint32_t)Bundle::Flags::IsMainMemOptimised;
-	}
-	else if (meta["bundle"]["mainMemOptimised"].as<bool>())
-	{
-		bundle.flags |= (uint32_t)Bundle::Flags::IsMainMemOptimised;
-	}
-	if (!meta["bundle"]["graphicsMemOptimised"] || !meta["bundle"]["graphicsMemOptimised"].IsScalar())
-	{
-		qWarning() << "Flag \"graphicsMemOptimised\" is unspecified or invalid. Defaulting to true.";
-		bundle.flags |= (uint32_t)Bundle::Flags::IsGraphicsMemOptimised;
-	}
-	else if (meta["bundle"]["graphicsMemOptimised"].as<bool>())
-	{
-		bundle.flags |= (uint32_t)Bundle::Flags::IsGraphicsMemOptimised;
-	}
+// The bundle-wide settings come from the index or the validated metadata
+void YAP::createBundle(GameDataStream& stream, Bundle& bundle)
+{
+	bundle.magic = "bnd2";
+	bundle.version = 2;
+	bundle.platform = indexHeader.platform;
+	setPlatform(stream, bundle);
+	bundle.resourceCount = !indexedResources.isEmpty() ? indexedResources.size() : resourceDescriptors.size();
+	if (bundle.resourceCount == 0)
+		qWarning() << "Metadata file contains no resources.";
+	layoutBundle(bundle);
+	bundle.flags |= indexHeader.flags & ((uint32_t)Bundle::Flags::IsCompressed
+		| (uint32_t)Bundle::Flags::IsMainMemOptimised | (uint32_t)Bundle::Flags::IsGraphicsMemOptimised);
 	std::cout << "Created bundle header\n";
 }
 
@@ -118,66 +98,31 @@ void YAP::setPlatform(GameDataStream& stream, Bundle bundle)
 		stream.setPlatform(GameDataStream::Platform::PS3);
 }
 
-void YAP::createResourceEntry(YAML::const_iterator& resource, Bundle& bundle, int index)
+void YAP::createResourceEntry(Bundle& bundle, int index)
 {
+	const ResourceDescriptor& descriptor = resourceDescriptors[index];
 	ResourceEntry entry;
-	stringToUInt(QString::fromStdString(resource->first.as<std::string>()), entry.id, true); // Already validated
-	entry.type = resource->second["type"].as<uint32_t>();
-
-	// Set up files and imports
-	int secondaryMemType = resource->second["secondaryMemoryType"].as<int>(-1);
-	bool usingCombinedImports = true;
-	bool noImports = false;
-	QFileInfo dataFileInfo(resourceFiles[index][0]);
-	QFileInfo secondaryFileInfo;
-	if (!resourceFiles[index][1].isEmpty())
-		secondaryFileInfo.setFile(resourceFiles[index][1]);
-	QFileInfo importsFileInfo(inPath + importsFilename);
-	if (!resourceFiles[index][2].isEmpty())
-	{
-		importsFileInfo.setFile(resourceFiles[index][2]);
-		usingCombinedImports = false;
-	}
-	YAML::Node imports;
-	YAML::Node resourceImports; // Imports for this specific resource
-	if (!importsFileInfo.exists())
-		noImports = true;
-	if (usingCombinedImports)
-	{
-		if (!combinedImports[resource->first.as<std::string>()])
-			noImports = true;
-		else
-			resourceImports = combinedImports[resource->first.as<std::string>()];
-	}
-	else if (!noImports && !usingCombinedImports)
-	{
-		resourceImports = YAML::LoadFile(importsFileInfo.absoluteFilePath().toStdString());
-	}
+	entry.id = descriptor.id;
+	entry.type = descriptor.type;
 
-	// Create import entries and set import hash
-	if (!noImports)
-	{
-		for (YAML::const_iterator impEntryIt = resourceImports.begin();
-			impEntryIt != resourceImports.end(); ++impEntryIt)
-		{
-			ImportEntry impEntry;
-			stringToUInt<uint32_t>(QString::fromStdString(impEntryIt->begin()->first.as<std::string>()), impEntry.offset, true);
-			impEntry.id = impEntryIt->begin()->second.as<uint64_t>();
-			entry.imports.append(impEntry);
-			entry.importCount++;
-			entry.importsHash |= impEntry.id;
-		}
-	}
+	// Set up imports, already read when validating
+	int secondaryMemType = descriptor.secondaryMemoryType;
+	entry.imports = importTable.value(entry.id);
+	entry.importCount = entry.imports.size();
+	for (const ImportEntry& import : entry.imports)
+		entry.importsHash |= import.id;
 
 	// Uncompressed size and alignment
-	uint32_t primaryAlignment = (uint32_t)log2(resource->second["alignment"][0].as<uint16_t>(defaultPrimaryAlignment)) << 28;
-	uint32_t primarySize = dataFileInfo.size();
+	uint16_t alignment = descriptor.alignment[0] != 0 ? descriptor.alignment[0] : defaultPrimaryAlignment;
+	uint32_t primaryAlignment = (uint32_t)log2(alignment) << 28;
+	uint32_t primarySize = inputSize(resourceFiles[index][0]);
 	uint32_t importsSize = entry.importCount * 0x10;
 	entry.uncompressedInfo[0] = primarySize + importsSize + primaryAlignment;
 	if (secondaryMemType != -1)
 	{
-		uint32_t secondaryAlignment = (uint32_t)log2(resource->second["alignment"][1].as<uint16_t>(defaultSecondaryAlignment)) << 28;
-		uint32_t secondarySize = secondaryFileInfo.size();
+		alignment = descriptor.alignment[1] != 0 ? descriptor.alignment[1] : defaultSecondaryAlignment;
+		uint32_t secondaryAlignment = (uint32_t)log2(alignment) << 28;
+		uint32_t secondarySize = inputSize(resourceFiles[index][1]);
 		entry.uncompressedInfo[secondaryMemType] = secondarySize + secondaryAlignment;
 	}
 
@@ -191,141 +136,487 @@ void YAP::createResourceEntry(YAML::const_iterator& resource, Bundle& bundle, in
 	std::cout << "\rCreated resource entry " << index + 1 << "/" << bundle.resourceCount;
 }
 
+// Equivalent to createResourceEntry() for an unchanged extracted folder, where
+// the sizes and alignments already in the index are the ones it would compute
+void YAP::createIndexedResourceEntry(Bundle& bundle, int index)
+{
+	const IndexEntry& indexed = indexedResources[index];
+	ResourceEntry entry;
+	entry.id = indexed.id;
+	entry.type = indexed.type;
+	entry.imports = indexed.imports;
+	entry.importCount = indexed.imports.size();
+	for (const ImportEntry& import : entry.imports)
+		entry.importsHash |= import.id;
+
+	entry.uncompressedInfo[0] = indexed.uncompressedInfo[0];
+	if (indexed.compressedSize[1] != 0)
+		entry.uncompressedInfo[1] = indexed.uncompressedInfo[1];
+	else if (indexed.compressedSize[2] != 0)
+		entry.uncompressedInfo[2] = indexed.uncompressedInfo[2];
+	if (entry.importCount > 0)
+		entry.importsOffset = (entry.uncompressedInfo[0] & 0x0FFFFFFF) - entry.importCount * 0x10;
+
+	bundle.entries.append(entry);
+	std::cout << "\rCreated resource entry " << index + 1 << "/" << bundle.resourceCount;
+}
+
 bool YAP::compareResourceEntry(const ResourceEntry& a, const ResourceEntry& b)
 {
 	return a.id < b.id;
 }
 
-bool YAP::compareResourceFileList(const QStringList& a, const QStringList& b)
+// Orders the entries by ID, keeping each one's files alongside it
+void YAP::sortResourceEntries(Bundle& bundle)
 {
-	QString aStr = a[0].sliced(a[0].lastIndexOf('/') + 1, 8);
-	QString bStr = b[0].sliced(b[0].lastIndexOf('/') + 1, 8);
-	return std::stoull(aStr.toStdString(), nullptr, 16) < std::stoull(bStr.toStdString(), nullptr, 16);
+	QList<int> order(bundle.resourceCount);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+	{
+		return compareResourceEntry(bundle.entries[a], bundle.entries[b]);
+	});
+	QList<ResourceEntry> entries;
+	QList<QStringList> files;
+	entries.reserve(order.size());
+	files.reserve(order.size());
+	for (int index : order)
+	{
+		entries.append(std::move(bundle.entries[index]));
+		files.append(std::move(resourceFiles[index]));
+	}
+	bundle.entries = std::move(entries);
+	resourceFiles = std::move(files);
 }
 
-void YAP::createResource(QByteArray& data, Bundle& bundle, int index, int memType, GameDataStream::Platform platform)
+// Every portion with data, as index * 3 + memType, in the order they're
+// written to the bundle
+QList<uint32_t> YAP::listPortions(Bundle& bundle)
 {
-	if ((bundle.entries[index].uncompressedInfo[memType] & 0x0FFFFFFF) == 0)
-		return;
-
-	// Align start
-	uint16_t align = memType == 0 ? 0x10 : 0x80;
-	uint32_t alignedSize = data.size();
-	if (alignedSize % align != 0)
-		alignedSize = align * ((alignedSize + (align - 1)) / align);
-	data.resize(alignedSize, '\0');
-
-	QFile file;
-	if (memType == 0)
-		file.setFileName(resourceFiles[index][0]);
-	else
-		file.setFileName(resourceFiles[index][1]);
+	QList<uint32_t> work;
+	for (int i = 0; i < 3; ++i)
+	{
+		for (uint32_t j = 0; j < bundle.resourceCount; ++j)
+		{
+			if ((bundle.entries[j].uncompressedInfo[i] & 0x0FFFFFFF) != 0)
+				work.append(j * 3 + i);
+		}
+	}
+	return work;
+}
 
-	// Get data
-	file.open(QIODeviceBase::ReadOnly);
-	QByteArray resourceData = file.readAll();
-	file.close();
+bool YAP::resolveTypeLevels()
+{
+	for (auto it = typeLevelStrings.cbegin(); it != typeLevelStrings.cend(); ++it)
+	{
+		QList<uint32_t> types;
+		if (!resolveTypeString(it.key(), types))
+			return false;
+		for (uint32_t type : types)
+			typeLevels.insert(type, it.value());
+	}
+	return true;
+}
 
-	// Append imports, if they exist
-	if (memType == 0)
+QList<int> YAP::compressionLevels(uint32_t type)
+{
+	if (typeLevels.contains(type))
+		return { typeLevels.value(type) };
+	if (compressionProfile == "ship")
+		return { 9, 10, 11, 12 };
+	return { compressionLevel };
+}
+
+void YAP::createResources(Bundle& bundle, GameDataStream::Platform platform, const QList<uint32_t>& work,
+	const std::function<void(qsizetype position, QByteArray& portion)>& commit)
+{
+	// Portions are compressed independently, so they're handed out one at a
+	// time to a pool of workers, each with its own compressors. The main thread
+	// takes part using the existing one. Finished portions are committed in
+	// work order by whichever worker completes the next one due, so the bundle
+	// is the same regardless of the number of workers. Workers stay within a
+	// window of the last commit so only that many portions are ever held.
+	// Duplicates found beforehand are committed empty, without compressing.
+	const qsizetype window = std::max<qsizetype>(jobs * 4, 16);
+	std::atomic<qsizetype> nextItem = 0;
+	std::mutex commitMutex;
+	std::condition_variable committed;
+	std::map<qsizetype, QByteArray> finished;
+	qsizetype committedCount = 0;
+	auto run = [&](CreateWorker& worker)
+	{
+		for (qsizetype i = nextItem++; i < work.size(); i = nextItem++)
+		{
+			{
+				std::unique_lock<std::mutex> lock(commitMutex);
+				committed.wait(lock, [&] { return i < committedCount + window; });
+			}
+			uint32_t item = work[i];
+			QByteArray portion;
+			// Fewer portions left than workers means some are idle
+			worker.parallelLevels = work.size() - i < (qsizetype)jobs;
+			if (duplicateOf.isEmpty() || duplicateOf[i] == -1)
+				portion = createResource(worker, bundle, item / 3, item % 3, platform);
+
+			std::lock_guard<std::mutex> lock(commitMutex);
+			finished.emplace(i, std::move(portion));
+			for (auto it = finished.begin(); it != finished.end() && it->first == committedCount; it = finished.erase(it))
+			{
+				commit(committedCount, it->second);
+				++committedCount;
+			}
+			committed.notify_all();
+			std::cout << "\rAdded resource portion " << committedCount << "/" << work.size() << std::flush;
+		}
+	};
+	auto freeCompressors = [&](CreateWorker& worker)
+	{
+		for (libdeflate_compressor* compressor : worker.compressors)
+		{
+			if (compressor != nullptr && compressor != cmp)
+				libdeflate_free_compressor(compressor);
+		}
+	};
+
+	std::atomic<uint32_t> cacheHits = 0;
+	std::vector<std::thread> workers;
+	uint32_t workerCount = std::min<qsizetype>(jobs, work.size());
+	for (uint32_t i = 1; i < workerCount; ++i)
+	{
+		workers.emplace_back([&]
+		{
+			CreateWorker worker;
+			run(worker);
+			freeCompressors(worker);
+			cacheHits += worker.cacheHits;
+		});
+	}
+	CreateWorker mainWorker;
+	mainWorker.compressors[compressionLevel] = cmp;
+	run(mainWorker);
+	freeCompressors(mainWorker);
+	for (std::thread& worker : workers)
+		worker.join();
+	cacheHits += mainWorker.cacheHits;
+
+	if (!cachePath.isEmpty())
+		std::cout << "\nReused " << cacheHits << "/" << work.size() << " portions from the cache";
+}
+
+// Compresses a sample of the portions and scales the result up to the whole
+// bundle, without writing anything
+void YAP::estimateBundle(Bundle& bundle, GameDataStream::Platform platform, const QList<uint32_t>& work)
+{
+	const qsizetype maxSamples = 256;
+	qsizetype stride = std::max<qsizetype>(1, (work.size() + maxSamples - 1) / maxSamples);
+	QList<uint32_t> sample;
+	uint64_t totalSize = 0;
+	uint64_t sampleSize = 0;
+	for (qsizetype i = 0; i < work.size(); ++i)
 	{
-		QBuffer importData;
-		GameDataStream stream(&importData, platform);
-		importData.open(QIODeviceBase::WriteOnly);
-		for (int i = 0; i < bundle.entries[index].importCount; ++i)
+		uint64_t size = bundle.entries[work[i] / 3].uncompressedInfo[work[i] % 3] & 0x0FFFFFFF;
+		totalSize += size;
+		if (i % stride == 0)
 		{
-			stream << bundle.entries[index].imports[i].id;
-			stream << bundle.entries[index].imports[i].offset;
-			stream << (uint32_t)0;
+			sample.append(work[i]);
+			sampleSize += size;
 		}
-		importData.close();
-		resourceData.append(importData.buffer());
 	}
 
+	uint64_t sampleCompressedSize = 0;
+	QElapsedTimer timer;
+	timer.start();
+	createResources(bundle, platform, sample, [&](qsizetype, QByteArray& portion)
+	{
+		sampleCompressedSize += portion.size();
+	});
+	qint64 elapsed = timer.elapsed();
+
+	double scale = sampleSize == 0 ? 0 : (double)totalSize / sampleSize;
+	uint64_t estimatedSize = bundle.resourceData[0] + (uint64_t)(sampleCompressedSize * scale);
+	std::cout << "\n\nProfile " << compressionProfile.toStdString() << ", " << jobs << " jobs, sampled "
+		<< sample.size() << "/" << work.size() << " portions\n"
+		<< "Uncompressed size: " << totalSize << " bytes\n"
+		<< "Estimated bundle size: " << estimatedSize << " bytes ("
+		<< QString::number(sampleSize == 0 ? 0 : (double)sampleCompressedSize / sampleSize, 'f', 4).toStdString() << " ratio)\n"
+		<< "Estimated compression time: " << QString::number(elapsed * scale / 1000.0, 'f', 1).toStdString() << "s";
+}
+
+// Hashes the uncompressed data of every portion so each distinct one is only
+// compressed once. Each later copy is marked as a duplicate of the first.
+void YAP::findDuplicatePortions(Bundle& bundle, GameDataStream::Platform platform, const QList<uint32_t>& work)
+{
+	QList<QByteArray> hashes(work.size());
+	std::atomic<qsizetype> nextItem = 0;
+	auto run = [&]
+	{
+		for (qsizetype i = nextItem++; i < work.size(); i = nextItem++)
+		{
+			// Portions can only share data within a memory type
+			hashes[i] = QCryptographicHash::hash(readPortion(bundle, work[i] / 3, work[i] % 3, platform),
+				QCryptographicHash::Blake2b_256) + char('0' + work[i] % 3);
+		}
+	};
+	std::vector<std::thread> workers;
+	uint32_t workerCount = std::min<qsizetype>(jobs, work.size());
+	for (uint32_t i = 1; i < workerCount; ++i)
+		workers.emplace_back(run);
+	run();
+	for (std::thread& worker : workers)
+		worker.join();
+
+	QHash<QByteArray, qsizetype> firstItems;
+	duplicateOf.fill(-1, work.size());
+	duplicateBytes = 0;
+	uint32_t duplicateCount = 0;
+	for (qsizetype i = 0; i < work.size(); ++i)
+	{
+		qsizetype first = firstItems.value(hashes[i], -1);
+		if (first == -1)
+		{
+			firstItems.insert(hashes[i], i);
+			continue;
+		}
+		duplicateOf[i] = first;
+		duplicateBytes += bundle.entries[work[i] / 3].uncompressedInfo[work[i] % 3] & 0x0FFFFFFF;
+		++duplicateCount;
+	}
+	std::cout << "Found " << duplicateCount << "/" << work.size() << " duplicate portions\n";
+}
+
+// The uncompressed data of a portion, with imports appended to the primary
+QByteArray YAP::readPortion(Bundle& bundle, int index, int memType, GameDataStream::Platform platform)
+{
+	const ResourceEntry& entry = bundle.entries[index];
+
+	// Get data
+	QByteArray resourceData = readInput(resourceFiles[index][memType == 0 ? 0 : 1]);
+
+	// Append imports, if they exist
+	if (memType == 0 && entry.importCount > 0)
+	{
+		qsizetype resourceSize = resourceData.size();
+		resourceData.resize(resourceSize + entry.importCount * 0x10);
+		encodeImports(platform != GameDataStream::Platform::PC, entry.imports.constData(),
+			entry.importCount, (uchar*)resourceData.data() + resourceSize);
+	}
+	return resourceData;
+}
+
+QByteArray YAP::createResource(CreateWorker& worker, Bundle& bundle, int index, int memType, GameDataStream::Platform platform)
+{
+	ResourceEntry& entry = bundle.entries[index];
+	QByteArray resourceData = readPortion(bundle, index, memType, platform);
+
 	// Compress data if specified
 	if (bundle.flags & (uint32_t)Bundle::Flags::IsCompressed)
 	{
-		// No idea how much bigger zlib can be than uncompressed but +1024 should be ok
-		char* compressedData = new char[resourceData.size() + 1024];
-		size_t cmpSize = libdeflate_zlib_compress(cmp, resourceData.constData(), resourceData.size(), compressedData, resourceData.size() + 1024);
-		resourceData.setRawData(compressedData, cmpSize);
-		bundle.entries[index].compressedSize[memType] = cmpSize; // Compressed size
+		QByteArray compressedData = compressPortion(worker, entry.type, resourceData);
+		entry.compressedSize[memType] = compressedData.size();
+		return compressedData;
 	}
-	else
+	entry.compressedSize[memType] = entry.uncompressedInfo[memType] & 0x0FFFFFFF;
+	return resourceData;
+}
+
+// Keeps the smallest result if the profile tries more than one level. Ties go
+// to the first level tried. Each level has its own compressor, so the levels
+// are tried at once if the worker says other cores would otherwise be idle.
+QByteArray YAP::compressPortion(CreateWorker& worker, uint32_t type, const QByteArray& data)
+{
+	QList<int> levels = compressionLevels(type);
+	QByteArray key;
+	if (!cachePath.isEmpty())
 	{
-		bundle.entries[index].compressedSize[memType] = bundle.entries[index].uncompressedInfo[memType] & 0x0FFFFFFF;
+		key = cacheKey(data, levels);
+		QByteArray cached = readCache(key);
+		if (!cached.isNull())
+		{
+			++worker.cacheHits;
+			return cached;
+		}
 	}
-	
-	// Add to the existing array
-	bundle.entries[index].offset[memType] = data.size(); // Disk offset
-	data.append(resourceData);
-	if (index == 0 && memType != 0)
-		std::cout << '\n';
-	if (memType == 0)
-		std::cout << "\rAdded primary portion for resource " << index + 1 << "/" << bundle.resourceCount;
-	else
-		std::cout << "\rAdded secondary portion for resource " << index + 1;
+
+	for (int level : levels)
+	{
+		if (worker.compressors[level] == nullptr)
+			worker.compressors[level] = libdeflate_alloc_compressor(level);
+	}
+	QList<QByteArray> attempts(levels.size());
+	auto tryLevel = [&](qsizetype i)
+	{
+		libdeflate_compressor* compressor = worker.compressors[levels[i]];
+		QByteArray attempt(libdeflate_zlib_compress_bound(compressor, data.size()), Qt::Uninitialized);
+		size_t cmpSize = libdeflate_zlib_compress(compressor, data.constData(), data.size(),
+			attempt.data(), attempt.size());
+		attempt.truncate(cmpSize);
+		attempts[i] = attempt;
+	};
+	std::vector<std::thread> threads;
+	for (qsizetype i = 1; i < levels.size() && worker.parallelLevels; ++i)
+		threads.emplace_back(tryLevel, i);
+	for (qsizetype i = 0; i < (worker.parallelLevels ? 1 : levels.size()); ++i)
+		tryLevel(i);
+	for (std::thread& thread : threads)
+		thread.join();
+
+	QByteArray compressedData;
+	for (const QByteArray& attempt : attempts)
+	{
+		if (compressedData.isEmpty() || attempt.size() < compressedData.size())
+			compressedData = attempt;
+	}
+	if (!cachePath.isEmpty())
+		writeCache(key, compressedData);
+	return compressedData;
 }
 
-void YAP::outputBundle(GameDataStream& stream, Bundle& bundle, QByteArray data[])
+void YAP::outputBundle(GameDataStream& stream, Bundle& bundle, const QList<uint32_t>& work)
 {
-	stream.device()->open(QIODeviceBase::WriteOnly);
-	
-	// Update resource data offsets
-	bundle.resourceData[1] = bundle.resourceData[0] + data[0].size();
-	if (bundle.resourceData[1] % 0x80 != 0)
-		bundle.resourceData[1] = 0x80 * ((bundle.resourceData[1] + 0x7F) / 0x80);
-	bundle.resourceData[2] = bundle.resourceData[1] + data[1].size();
-	if (bundle.resourceData[2] % 0x80 != 0)
-		bundle.resourceData[2] = 0x80 * ((bundle.resourceData[2] + 0x7F) / 0x80);
-	
-	// Write bundle header
-	stream.writeString(bundle.magic);
-	stream << bundle.version;
-	stream << bundle.platform;
-	stream << bundle.debugData;
-	stream << bundle.resourceCount;
-	stream << bundle.resourceEntries;
-	for (int i = 0; i < 3; ++i)
-		stream << bundle.resourceData[i];
-	stream << bundle.flags;
+	QIODevice* device = stream.device();
+	device->open(QIODeviceBase::WriteOnly);
+
+	// Reserve space for the header, debug data, and resource entries, which
+	// are written last once the resource data offsets are known. Resource data
+	// is then streamed to its final place as each portion is committed.
+	auto padTo = [&](qint64 position)
+	{
+		if (position > device->pos())
+			device->write(QByteArray(position - device->pos(), '\0'));
+	};
+	auto alignUp = [](qint64 value, qint64 align)
+	{
+		return (value + align - 1) / align * align;
+	};
+	padTo(bundle.resourceData[0]);
+	// When deduplicating, the first copy of each duplicated portion is kept
+	// until its last duplicate is written
+	QHash<qsizetype, qsizetype> duplicatesLeft;
+	QHash<qsizetype, QByteArray> firstCopies;
+	for (qsizetype first : duplicateOf)
+	{
+		if (first != -1)
+			++duplicatesLeft[first];
+	}
+	uint64_t sharedBytes = 0;
+	uint32_t regionSize[3] = { 0, 0, 0 };
+	int memType = 0;
+	// Memory type regions after the first start on 0x80 byte boundaries
+	auto startRegion = [&](int next)
+	{
+		for (; memType < next; ++memType)
+		{
+			bundle.resourceData[memType + 1] = alignUp(bundle.resourceData[memType] + regionSize[memType], 0x80);
+			padTo(bundle.resourceData[memType + 1]);
+		}
+	};
+	QElapsedTimer timer;
+	timer.start();
+	createResources(bundle, stream.platform(), work, [&](qsizetype position, QByteArray& portion)
+	{
+		uint32_t item = work[position];
+		int index = item / 3;
+		int portionMemType = item % 3;
+		qsizetype first = duplicateOf.isEmpty() ? -1 : duplicateOf[position];
+		if (first != -1)
+		{
+			const ResourceEntry& firstEntry = bundle.entries[work[first] / 3];
+			bundle.entries[index].compressedSize[portionMemType] = firstEntry.compressedSize[portionMemType];
+			if (dedupMode == "share")
+			{
+				// Point at the first copy's data instead of writing it again
+				bundle.entries[index].offset[portionMemType] = firstEntry.offset[portionMemType];
+				sharedBytes += firstEntry.compressedSize[portionMemType];
+				return;
+			}
+			portion = firstCopies.value(first);
+			if (--duplicatesLeft[first] == 0)
+				firstCopies.remove(first);
+		}
+		else if (duplicatesLeft.contains(position))
+			firstCopies.insert(position, portion);
+		startRegion(portionMemType);
+		uint32_t offset = alignUp(regionSize[portionMemType], portionMemType == 0 ? 0x10 : 0x80);
+		padTo(bundle.resourceData[portionMemType] + offset);
+		device->write(portion);
+		bundle.entries[index].offset[portionMemType] = offset; // Disk offset
+		regionSize[portionMemType] = offset + portion.size();
+	});
+	startRegion(2);
+	qint64 elapsed = timer.elapsed();
+	std::cout << '\n';
+	if (!duplicateOf.isEmpty())
+	{
+		// Estimated from the rate the rest of the data was compressed at
+		uint64_t totalBytes = 0;
+		for (uint32_t item : work)
+			totalBytes += bundle.entries[item / 3].uncompressedInfo[item % 3] & 0x0FFFFFFF;
+		uint64_t compressedBytes = totalBytes - duplicateBytes;
+		double savedTime = compressedBytes == 0 ? 0 : (double)elapsed * duplicateBytes / compressedBytes;
+		std::cout << "Deduplication skipped compressing " << duplicateBytes << " bytes, saving about "
+			<< QString::number(savedTime / 1000.0, 'f', 1).toStdString() << "s";
+		if (dedupMode == "share")
+			std::cout << " and " << sharedBytes << " bytes of bundle data";
+		std::cout << '\n';
+	}
+	writeBundleHeader(stream, bundle);
 
 	// Write debug data
 	if (bundle.flags & (uint32_t)Bundle::Flags::ContainsDebugData)
 	{
 		stream.seek(bundle.debugData);
-		QFile debugDataFile(inPath + debugDataFilename);
-		debugDataFile.open(QIODeviceBase::ReadOnly);
-		QByteArray debugData = debugDataFile.readAll();
-		debugDataFile.close();
+		QByteArray debugData = readInput(inPath + debugDataFilename);
 		stream.writeString(debugData);
 	}
 
-	// Write resource entries
-	stream.seek(bundle.resourceEntries);
-	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
-	{
-		stream << bundle.entries[i].id;
-		stream << bundle.entries[i].importsHash;
-		for (int j = 0; j < 3; ++j)
-			stream << bundle.entries[i].uncompressedInfo[j];
-		for (int j = 0; j < 3; ++j)
-			stream << bundle.entries[i].compressedSize[j];
-		for (int j = 0; j < 3; ++j)
-			stream << bundle.entries[i].offset[j];
-		stream << bundle.entries[i].importsOffset;
-		stream << bundle.entries[i].type;
-		stream << bundle.entries[i].importCount;
-		stream << bundle.entries[i].flags;
-		stream << bundle.entries[i].stream;
-	}
-
-	// Write resource data
-	stream.writeRawData(data[0].constData(), bundle.resourceData[1] - bundle.resourceData[0]);
-	stream.writeRawData(data[1].constData(), bundle.resourceData[2] - bundle.resourceData[1]);
-	stream.writeRawData(data[2].constData(), data[2].size());
+	writeResourceEntries(stream, bundle, 0, bundle.resourceCount);
 
 	// Save
 	stream.close();
 	std::cout << "Bundle created.";
 }
+
+void YAP::writeBundleHeader(GameDataStream& stream, Bundle& bundle)
+{
+	bool bigEndian = stream.platform() != GameDataStream::Platform::PC;
+	BundleLayout::HeaderRecord header = {};
+	std::memcpy(header.magic, bundle.magic.toLatin1().constData(), 4);
+	header.version = bundle.version;
+	header.platform = bundle.platform;
+	header.debugData = bundle.debugData;
+	header.resourceCount = bundle.resourceCount;
+	header.resourceEntries = bundle.resourceEntries;
+	for (int i = 0; i < 3; ++i)
+		header.resourceData[i] = bundle.resourceData[i];
+	header.flags = bundle.flags;
+	BundleLayout::convert(bigEndian, &header, 1, BundleLayout::headerFields);
+	stream.seek(0);
+	stream.writeRawData((const char*)&header, BundleLayout::headerSize);
+}
+
+// Writes count entries starting from first, in place in the entries block
+void YAP::writeResourceEntries(GameDataStream& stream, Bundle& bundle, uint32_t first, uint32_t count)
+{
+	bool bigEndian = stream.platform() != GameDataStream::Platform::PC;
+	std::vector<BundleLayout::EntryRecord> records(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const ResourceEntry& entry = bundle.entries[first + i];
+		BundleLayout::EntryRecord& record = records[i];
+		record.id = entry.id;
+		record.importsHash = entry.importsHash;
+		for (int j = 0; j < 3; ++j)
+		{
+			record.uncompressedInfo[j] = entry.uncompressedInfo[j];
+			record.compressedSize[j] = entry.compressedSize[j];
+			record.offset[j] = entry.offset[j];
+		}
+		record.importsOffset = entry.importsOffset;
+		record.type = entry.type;
+		record.importCount = entry.importCount;
+		record.flags = entry.flags;
+		record.stream = entry.stream;
+	}
+	BundleLayout::convert(bigEndian, records.data(), records.size(), BundleLayout::entryFields);
+	stream.seek(bundle.resourceEntries + first * BundleLayout::entrySize);
+	stream.writeRawData((const char*)records.data(), records.size() * BundleLayout::entrySize);
+}
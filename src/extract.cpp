@@ -1,8 +1,43 @@
 #include <yap.h>
+#include <bundle-layout.h>
+#include <import-codec.h>
+#include <output-queue.h>
 #include <QByteArray>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QScopedPointer>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// Metadata and imports are written directly in the form YAML::Emitter gave
+	// them, so existing folders and their diffs stay the same
+	void appendDecimal(QByteArray& out, uint64_t value)
+	{
+		char digits[20];
+		char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+		out.append(digits, end - digits);
+	}
+
+	// Lowercase with a 0x prefix, zero-padded to at least width digits
+	void appendHex(QByteArray& out, uint64_t value, int width = 0)
+	{
+		char digits[16];
+		char* end = std::to_chars(digits, digits + sizeof(digits), value, 16).ptr;
+		out.append("0x");
+		for (qsizetype i = end - digits; i < width; ++i)
+			out.append('0');
+		out.append(digits, end - digits);
+	}
+}
 
 int YAP::extract()
 {
@@ -15,15 +50,80 @@ int YAP::extract()
 	createDecompressor();
 	Bundle bundle;
 	readBundle(inStream, bundle); // Bundle header and resource entries
-	if (!validateResourceEntries(bundle))
+	std::cout << "Read bundle and resource info\n";
+	uint32_t validCount = 0;
+	if (!validateResourceEntries(bundle, &validCount) && !salvage)
 		return 3;
-	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
-		extractResource(inStream, bundle, i);
+	QList<uint32_t> selection;
+	if (!selectResources(bundle, selection))
+		return 4;
+	QList<uint32_t> untrusted; // Only matched to salvaged data
+	if (validCount < bundle.resourceCount)
+	{
+		QList<uint32_t> trusted;
+		for (uint32_t index : selection)
+			(index < validCount ? trusted : untrusted).append(index);
+		selection = trusted;
+	}
+	// Map the whole bundle so resource data is used in place rather than read
+	// into a buffer per portion. If it can't be mapped, fall back to reading.
+	mappedBundleSize = inFile.size();
+	mappedBundle = inFile.map(0, mappedBundleSize);
+	QFile archiveFile;
+	QScopedPointer<OutputQueue> outputQueue;
+	if (archivePath.isEmpty())
+		outputQueue.reset(new OutputQueue(std::clamp<uint32_t>(jobs, 1, 4), 0x10000000));
+	else
+	{
+		if (archivePath == "-")
+			archiveFile.open(stdout, QIODeviceBase::WriteOnly);
+		else
+		{
+			archiveFile.setFileName(archivePath);
+			archiveFile.open(QIODeviceBase::WriteOnly);
+		}
+		qint64 modifiedTime = QFileInfo(inPath).lastModified().toSecsSinceEpoch();
+		outputQueue.reset(new OutputQueue(&archiveFile, modifiedTime, 0x10000000));
+	}
+	output = outputQueue.data();
+	// The index is only kept alongside extracted folders, and only when the
+	// bundle is intact
+	if (archivePath.isEmpty() && !salvage)
+	{
+		if (incremental)
+			readIndex();
+		extractIndex.resize(bundle.resourceCount);
+	}
+	extractResources(inStream, bundle, selection);
 	std::cout << '\n';
+	if (validCount < bundle.resourceCount)
+		salvageResources(inFile, bundle, validCount, untrusted, selection);
+
+	// Written in bundle order once everything is done so the file is the same
+	// regardless of the order resources finished in
+	if (combineImports)
+	{
+		QByteArray imports;
+		for (uint32_t index : selection)
+			appendImports(imports, bundle.entries[index]);
+		output->write(outPath + importsFilename, imports);
+	}
 	if (bundle.flags & (uint32_t)Bundle::Flags::ContainsDebugData)
 		outputDebugData(inStream, bundle);
+	outputMetadata(bundle, selection);
+	outputQueue->finish(); // Uncompressed data may still point into the mapping
+	output = nullptr;
+	archiveFile.close();
+	if (!extractIndex.isEmpty())
+	{
+		if (incremental)
+			removeStaleFiles(selection);
+		writeIndex(bundle, selection);
+	}
+	if (mappedBundle != nullptr)
+		inFile.unmap(mappedBundle);
+	mappedBundle = nullptr;
 	inFile.close();
-	outputMetadata(bundle);
 	std::cout << "Extraction complete";
 
 	return 0;
@@ -71,44 +171,49 @@ bool YAP::validateBundle(GameDataStream& stream)
 
 void YAP::readBundle(GameDataStream& stream, Bundle& bundle)
 {
-	stream.readString(bundle.magic, 4);
-	stream >> bundle.version;
-	stream >> bundle.platform;
-	stream >> bundle.debugData;
-	stream >> bundle.resourceCount;
-	stream >> bundle.resourceEntries;
+	// The header and entry table are each read in one go and converted in place
+	bool bigEndian = stream.platform() != GameDataStream::Platform::PC;
+	BundleLayout::HeaderRecord header = {};
+	stream.seek(0);
+	stream.device()->read((char*)&header, BundleLayout::headerSize);
+	BundleLayout::convert(bigEndian, &header, 1, BundleLayout::headerFields);
+	bundle.magic = QString::fromLatin1(header.magic, 4);
+	bundle.version = header.version;
+	bundle.platform = header.platform;
+	bundle.debugData = header.debugData;
+	bundle.resourceCount = header.resourceCount;
+	bundle.resourceEntries = header.resourceEntries;
 	for (int i = 0; i < 3; ++i)
-		stream >> bundle.resourceData[i];
-	stream >> bundle.flags;
-
-	// Read resource entries
+		bundle.resourceData[i] = header.resourceData[i];
+	bundle.flags = header.flags;
+
+	// Anything past the end of the file is left zeroed and fails validation
+	std::vector<BundleLayout::EntryRecord> records(bundle.resourceCount);
+	stream.seek(bundle.resourceEntries);
+	stream.device()->read((char*)records.data(), records.size() * BundleLayout::entrySize);
+	BundleLayout::convert(bigEndian, records.data(), records.size(), BundleLayout::entryFields);
+	bundle.entries.resize(bundle.resourceCount);
 	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
-		readResourceEntry(stream, bundle, i);
-
-	std::cout << "Read bundle and resource info\n";
-}
-
-void YAP::readResourceEntry(GameDataStream& stream, Bundle& bundle, int index)
-{
-	stream.seek(bundle.resourceEntries + index * 0x40);
-	ResourceEntry entry;
-	stream >> entry.id;
-	stream >> entry.importsHash;
-	for (int i = 0; i < 3; ++i)
-		stream >> entry.uncompressedInfo[i];
-	for (int i = 0; i < 3; ++i)
-		stream >> entry.compressedSize[i];
-	for (int i = 0; i < 3; ++i)
-		stream >> entry.offset[i];
-	stream >> entry.importsOffset;
-	stream >> entry.type;
-	stream >> entry.importCount;
-	stream >> entry.flags;
-	stream >> entry.stream;
-	bundle.entries.append(entry);
+	{
+		const BundleLayout::EntryRecord& record = records[i];
+		ResourceEntry& entry = bundle.entries[i];
+		entry.id = record.id;
+		entry.importsHash = record.importsHash;
+		for (int j = 0; j < 3; ++j)
+		{
+			entry.uncompressedInfo[j] = record.uncompressedInfo[j];
+			entry.compressedSize[j] = record.compressedSize[j];
+			entry.offset[j] = record.offset[j];
+		}
+		entry.importsOffset = record.importsOffset;
+		entry.type = record.type;
+		entry.importCount = record.importCount;
+		entry.flags = record.flags;
+		entry.stream = record.stream;
+	}
 }
 
-bool YAP::validateResourceEntries(Bundle& bundle)
+bool YAP::validateResourceEntries(Bundle& bundle, uint32_t* validCount)
 {
 	// Necessary for corrupt bundles recovered from HDDs. If the entries are
 	// corrupt, extraction cannot proceed correctly, so validation must be
@@ -118,42 +223,57 @@ bool YAP::validateResourceEntries(Bundle& bundle)
 	// entries can be trusted, but not the current or next entry.
 	// Technically, it also means entries 0-30 can always be trusted, but it's
 	// better to validate than to blindly trust.
+	// When salvaging, the entries before the first invalid one are trusted.
+	const char* aborted = salvage ? ".\nSalvaging the remaining resources." : ".\nExtraction aborted.";
+	// Deduplicated bundles may point several entries at exactly the same data,
+	// and patched bundles may have data moved after that of later entries
+	std::map<uint32_t, uint32_t> portions[3]; // Start offset to end offset
+	auto overlapsPortion = [&](int memType, uint32_t start, uint32_t end)
+	{
+		auto next = portions[memType].lower_bound(start);
+		if (next != portions[memType].end() && next->first < end)
+			return true;
+		return next != portions[memType].begin() && std::prev(next)->second > start;
+	};
+	QList<uint8_t> shared(bundle.resourceCount, 0); // Bit per memory type
 	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
 	{
+		if (validCount != nullptr)
+			*validCount = i;
 		ResourceEntry entry = bundle.entries[i];
 		if ((entry.id & 0xFFFFFFFF) == 0)
 		{
 			qCritical().noquote().nospace() << "Resource entry " << i
 				<< ": Null resource ID"
-				<< ".\nExtraction aborted.";
+				<< aborted;
 			return false;
 		}
 		if ((entry.id & 0xFFFFFFFF00000000) != 0)
 		{
 			qCritical().noquote().nospace() << "Resource entry " << i
 				<< ": Invalid resource ID 0x" << QString::number(entry.id, 16).toUpper()
-				<< ".\nExtraction aborted.";
+				<< aborted;
 			return false;
 		}
 		if ((entry.importsHash & 0xFFFFFFFF00000000) != 0)
 		{
 			qCritical().noquote().nospace() << "Resource entry " << i
 				<< ": Invalid imports hash 0x" << QString::number(entry.importsHash, 16).toUpper()
-				<< ".\nExtraction aborted.";
+				<< aborted;
 			return false;
 		}
 		if (entry.compressedSize[0] == 0)
 		{
 			qCritical().noquote().nospace() << "Resource entry " << i
 				<< ": Data size for main memory portion is 0"
-				<< ".\nExtraction aborted.";
+				<< aborted;
 			return false;
 		}
 		if (entry.type > 0x11004)
 		{
 			qCritical().noquote().nospace() << "Resource entry " << i
 				<< ": Invalid type 0x" << QString::number(entry.type, 16).toUpper()
-				<< ".\nExtraction aborted.";
+				<< aborted;
 			return false;
 		}
 		if (entry.importsOffset > (entry.uncompressedInfo[0] & 0x0FFFFFFF))
@@ -161,7 +281,7 @@ bool YAP::validateResourceEntries(Bundle& bundle)
 			qCritical().noquote().nospace() << "Resource entry " << i
 				<< ": Imports offset 0x" << QString::number(entry.importsOffset, 16).toUpper()
 				<< " is greater than resource size 0x" << QString::number(entry.uncompressedInfo[0] & 0x0FFFFFFF, 16).toUpper()
-				<< ".\nExtraction aborted.";
+				<< aborted;
 			return false;
 		}
 		for (int j = 0; j < 2; ++j)
@@ -172,7 +292,7 @@ bool YAP::validateResourceEntries(Bundle& bundle)
 				qCritical().noquote().nospace() << "Resource entry " << i << " memory type " << j
 					<< ": End offset 0x" << QString::number(resourceEnd, 16).toUpper()
 					<< " is greater than memory type " << j + 1 << " start offset 0x" << QString::number(bundle.resourceData[j + 1], 16).toUpper()
-					<< ".\nExtraction aborted.";
+					<< aborted;
 				return false;
 			}
 		}
@@ -184,15 +304,21 @@ bool YAP::validateResourceEntries(Bundle& bundle)
 				// or if there is no data for this memory type.
 				if (entry.offset[j] == 0 || entry.compressedSize[j] == 0)
 					continue;
+				auto same = portions[j].find(entry.offset[j]);
+				if (same != portions[j].end() && same->second == entry.offset[j] + entry.compressedSize[j])
+				{
+					shared[i] |= 1 << j;
+					continue;
+				}
 
 				// Not all resources have secondary portions.
 				// Check that there's resource data in the previous resource.
-				// If not, find the last one that does.
+				// If not, find the last one that does, other than shared data.
 				int resIndex = i - 1;
 				ResourceEntry prev = bundle.entries[resIndex];
-				if (prev.compressedSize[j] == 0)
+				if (prev.compressedSize[j] == 0 || (shared[resIndex] & (1 << j)))
 				{
-					while (prev.compressedSize[j] == 0 && resIndex >= 0)
+					while ((prev.compressedSize[j] == 0 || (shared[resIndex] & (1 << j))) && resIndex > 0)
 						prev = bundle.entries[--resIndex];
 
 					// Sanity check, should never be true
@@ -201,86 +327,256 @@ bool YAP::validateResourceEntries(Bundle& bundle)
 						qCritical().noquote().nospace() << "Resource entry " << i << " memory type " << j
 							<< ": Offset is not 0, yet there is no previous resource with data.\n"
 							<< "Open an issue on GitHub or contact burninrubber0 directly if this happens.\n"
-							<< "Extraction aborted.";
+							<< (aborted + 2);
 						return false;
 					}
 				}
 				
 				int resourceOffset = bundle.resourceData[j] + entry.offset[j];
 				int prevResourceEnd = bundle.resourceData[j] + prev.offset[j] + prev.compressedSize[j];
-				if (resourceOffset < prevResourceEnd)
+				// Out of order data is accepted if it overlaps no other data,
+				// since patching moves data that no longer fits. Salvaging
+				// keeps the strict order, as a corrupt entry can easily point
+				// somewhere unused.
+				if (resourceOffset < prevResourceEnd && (salvage
+					|| overlapsPortion(j, entry.offset[j], entry.offset[j] + entry.compressedSize[j])))
 				{
 					qCritical().noquote().nospace() << "Resource entry " << i << " memory type " << j
 						<< ": Start offset 0x" << QString::number(resourceOffset, 16).toUpper()
 						<< " is less than the previous resource end offset 0x" << QString::number(prevResourceEnd, 16).toUpper()
-						<< ".\nExtraction aborted.";
+						<< aborted;
 					return false;
 				}
 			}
 		}
+		for (int j = 0; j < 3; ++j)
+		{
+			if (entry.compressedSize[j] != 0)
+				portions[j].emplace(entry.offset[j], entry.offset[j] + entry.compressedSize[j]);
+		}
 	}
+	if (validCount != nullptr)
+		*validCount = bundle.resourceCount;
 	return true;
 }
 
-void YAP::extractResource(GameDataStream& stream, Bundle& bundle, int index)
+bool YAP::selectResources(Bundle& bundle, QList<uint32_t>& selection)
+{
+	// Type names can only be resolved once the platform is known
+	QSet<uint32_t> types;
+	for (const QString& typeString : selectedTypeStrings)
+	{
+		QList<uint32_t> matched;
+		if (!resolveTypeString(typeString, matched))
+			return false;
+		for (uint32_t type : matched)
+			types.insert(type);
+	}
+
+	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
+	{
+		const ResourceEntry& entry = bundle.entries[i];
+		if (!selectedIds.isEmpty() && !selectedIds.contains(entry.id))
+			continue;
+		if (!types.isEmpty() && !types.contains(entry.type))
+			continue;
+		bool hasSelectedData = false;
+		for (int j = 0; j < 3; ++j)
+		{
+			if (selectedMemoryTypes[j] && entry.compressedSize[j] != 0)
+				hasSelectedData = true;
+		}
+		if (!hasSelectedData)
+			continue;
+		selection.append(i);
+	}
+
+	if (selection.isEmpty())
+		qWarning() << "No resources matched the specified filters.";
+	else if (selection.size() != bundle.resourceCount)
+		std::cout << "Selected " << selection.size() << "/" << bundle.resourceCount << " resources\n";
+	return true;
+}
+
+void YAP::extractResources(GameDataStream& stream, Bundle& bundle, const QList<uint32_t>& selection)
+{
+	// Resources are independent of each other, so they're handed out one at a
+	// time to a pool of workers. Each worker has its own decompressor and, if
+	// the bundle couldn't be mapped, its own file handle. The main thread takes
+	// part using the existing ones.
+	std::atomic<uint32_t> nextIndex = 0;
+	std::atomic<uint32_t> extractedCount = 0;
+	std::mutex progressMutex;
+	uint32_t selectedCount = selection.size();
+
+	// Sizes are known up front, so read buffers never need to grow
+	uint32_t maxCompressedSize[3] = { 0, 0, 0 };
+	for (uint32_t index : selection)
+	{
+		for (int i = 0; i < 3; ++i)
+			maxCompressedSize[i] = std::max(maxCompressedSize[i], bundle.entries[index].compressedSize[i]);
+	}
+
+	auto work = [&](ExtractWorker& worker)
+	{
+		if (mappedBundle == nullptr && (bundle.flags & (uint32_t)Bundle::Flags::IsCompressed))
+		{
+			for (int i = 0; i < 3; ++i)
+				worker.readBuffer[i].reserve(maxCompressedSize[i]);
+		}
+		for (uint32_t i = nextIndex++; i < selectedCount; i = nextIndex++)
+		{
+			extractResource(worker, bundle, selection[i], i);
+			output->closeGroup(i);
+			uint32_t extracted = ++extractedCount;
+			std::lock_guard<std::mutex> lock(progressMutex);
+			std::cout << "\rExtracted resource " << extracted << "/" << selectedCount << std::flush;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	uint32_t workerCount = std::min(jobs, selectedCount);
+	for (uint32_t i = 1; i < workerCount; ++i)
+	{
+		workers.emplace_back([&]
+		{
+			QFile file(inPath);
+			GameDataStream workerStream(&file);
+			workerStream.setPlatform(stream.platform());
+			if (mappedBundle == nullptr)
+				file.open(QIODeviceBase::ReadOnly);
+			ExtractWorker worker;
+			worker.stream = &workerStream;
+			worker.decompressor = libdeflate_alloc_decompressor();
+			work(worker);
+			libdeflate_free_decompressor(worker.decompressor);
+			file.close();
+		});
+	}
+	ExtractWorker mainWorker;
+	mainWorker.stream = &stream;
+	mainWorker.decompressor = dc;
+	work(mainWorker);
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void YAP::extractResource(ExtractWorker& worker, Bundle& bundle, int index, int group)
 {
 	ResourceEntry& entry = bundle.entries[index];
+	bool isCompressed = bundle.flags & (uint32_t)Bundle::Flags::IsCompressed;
+	for (int i = 0; i < 3; ++i)
+		worker.readAhead[i] = false;
+	if (!extractIndex.isEmpty() && indexResource(worker, bundle, index))
+		return; // Unchanged since the last extraction
 	for (int i = 0; i < 3; ++i)
 	{
 		if (entry.compressedSize[i] == 0) // No data
 			continue;
+		if (!selectedMemoryTypes[i])
+			continue;
 
-		// Get resource data
-		char* resource = new char[entry.compressedSize[i]];
-		stream.seek(entry.offset[i] + bundle.resourceData[i]);
-		stream.device()->read(resource, entry.compressedSize[i]);
+		// Get resource data, straight from the mapped bundle if possible.
+		// Otherwise it goes in the worker's read buffer, unless it's already
+		// there from hashing. Uncompressed data is output as is, so a recycled
+		// output buffer takes its place.
+		qint64 dataOffset = (qint64)entry.offset[i] + bundle.resourceData[i];
+		const char* data = nullptr;
+		QByteArray resource;
+		if (mappedBundle != nullptr)
+		{
+			if (dataOffset + entry.compressedSize[i] > mappedBundleSize)
+			{
+				qWarning().noquote().nospace()
+					<< "Resource 0x" << QString::number(entry.id, 16).toUpper().rightJustified(8, '0')
+					<< " memory type " << i << " extends past the end of the bundle.";
+				continue;
+			}
+			data = (const char*)mappedBundle + dataOffset;
+			// Stored data may be padded past the resource, which isn't part of it
+			if (!isCompressed)
+				resource = QByteArray::fromRawData(data,
+					std::min(entry.compressedSize[i], entry.uncompressedInfo[i] & 0x0FFFFFFF));
+		}
+		else
+		{
+			QByteArray& readBuffer = worker.readBuffer[i];
+			if (!worker.readAhead[i])
+			{
+				readBuffer.resize(entry.compressedSize[i]);
+				worker.stream->seek(dataOffset);
+				worker.stream->device()->read(readBuffer.data(), entry.compressedSize[i]);
+			}
+			if (!isCompressed)
+			{
+				resource = output->takeBuffer();
+				std::swap(resource, readBuffer);
+			}
+			data = isCompressed ? readBuffer.constData() : resource.constData();
+		}
 
 		// Decompress resource if compressed
 		uint32_t uncompressedSize = entry.uncompressedInfo[i] & 0x0FFFFFFF;
-		if (bundle.flags & 1)
+		if (isCompressed)
 		{
-			char* uncompressedData = new char[uncompressedSize];
-			auto r = libdeflate_zlib_decompress(dc, resource, entry.compressedSize[i], uncompressedData, uncompressedSize, nullptr);
-			delete[] resource;
+			resource = output->takeBuffer();
+			resource.resize(uncompressedSize);
+			auto r = libdeflate_zlib_decompress(worker.decompressor, data, entry.compressedSize[i], resource.data(), uncompressedSize, nullptr);
 			if (r != LIBDEFLATE_SUCCESS)
 			{
 				qWarning().noquote().nospace()
 					<< "Resource 0x" << QString::number(entry.id, 16).toUpper().rightJustified(8, '0')
 					<< " memory type " << i << " failed to extract.";
-				delete[] uncompressedData;
 				continue;
 			}
-			resource = uncompressedData;
 		}
-
-		// Read imports and set resource data size
-		uint32_t resourceDataLength = uncompressedSize;
-		if (i == 0 && entry.importCount > 0)
+		else if (uncompressedSize > entry.compressedSize[i])
 		{
-			uint32_t importsDataLength = entry.importCount * 0x10;
-			resourceDataLength -= importsDataLength;
-			QByteArray ba(resource + resourceDataLength, importsDataLength);
-			GameDataStream importStream(ba, stream.platform());
-			importStream.open(QIODeviceBase::ReadOnly);
-			for (int j = 0; j < entry.importCount; ++j)
-			{
-				ImportEntry importEntry;
-				importStream >> importEntry.id;
-				importStream >> importEntry.offset;
-				importStream.skip(4);
-				entry.imports.append(importEntry);
-			}
-			importStream.close();
+			qWarning().noquote().nospace()
+				<< "Resource 0x" << QString::number(entry.id, 16).toUpper().rightJustified(8, '0')
+				<< " memory type " << i << " is larger than its data on disk.";
+			continue;
 		}
+		else
+			resource.truncate(uncompressedSize);
 
-		outputResource(resource, resourceDataLength, generateFilePath(entry, i));
+		// Read imports in place and set resource data size
+		if (i == 0)
+			resource.truncate(readImports(bundle, entry, resource));
 
-		delete[] resource;
+		QString path = generateFilePath(entry, i);
+		if (!extractIndex.isEmpty())
+		{
+			extractIndex[index].files.append(path.sliced(outPath.size()));
+			extractIndex[index].fileSizes.append(resource.size());
+		}
+		outputResource(std::move(resource), path, group);
 	}
 
-	outputImports(bundle, index);
+	if (!combineImports)
+		outputImports(bundle, index, group);
+}
+
+// Reads the imports from the end of a primary portion, returning the size of
+// the data before them
+uint32_t YAP::readImports(Bundle& bundle, ResourceEntry& entry, const QByteArray& resource)
+{
+	uint32_t importsDataLength = entry.importCount * 0x10;
+	if (entry.importCount == 0)
+		return resource.size();
+	if (importsDataLength > (uint32_t)resource.size())
+	{
+		qWarning().noquote().nospace()
+			<< "Resource 0x" << QString::number(entry.id, 16).toUpper().rightJustified(8, '0')
+			<< " imports are larger than the resource. Imports will not be extracted.";
+		return resource.size();
+	}
 
-	std::cout << "\rExtracted resource " << index + 1 << "/" << bundle.resourceCount << std::flush;
+	uint32_t resourceDataLength = resource.size() - importsDataLength;
+	entry.imports.resize(entry.importCount);
+	decodeImports(bundle.platform != 1, (const uchar*)resource.constData() + resourceDataLength,
+		entry.imports.data(), entry.importCount);
+	return resourceDataLength;
 }
 
 // Returns the path + filename without extension
@@ -298,73 +594,69 @@ QString YAP::generateFilePath(ResourceEntry& entry, int memType)
 	if (!doNotSortByType) // Sort into type folders
 	{
 		if (resourceTypes.contains(entry.type))
-			outPathFinal += resourceTypes[entry.type] + "/";
+			outPathFinal += resourceTypes.value(entry.type) + "/";
 		else
 			outPathFinal += "0x" + QString::number(entry.type, 16).toUpper() + "/";
-		QDir().mkpath(outPathFinal);
+		// Folder is created when the first file is written to it
 	}
 	return outPathFinal + filename;
 }
 
-void YAP::outputResource(char* resource, int length, QString path)
+void YAP::outputResource(QByteArray resource, QString path, int group)
 {
-	QFile file(path);
-	file.open(QIODeviceBase::WriteOnly);
-	file.write(resource, length);
-	file.flush();
-	file.close();
+	output->write(path, std::move(resource), group);
 }
 
-void YAP::outputImports(Bundle& bundle, int resIndex)
+void YAP::outputImports(Bundle& bundle, int resIndex, int group)
 {
-	QFile importsFile;
-	if (combineImports)
-		importsFile.setFileName(outPath + importsFilename);
 	ResourceEntry& resEntry = bundle.entries[resIndex];
-	if (resEntry.importCount == 0)
+	if (resEntry.imports.isEmpty()) // None, or primary portion not extracted
 		return;
-	YAML::Emitter out;
-	out.SetIntBase(YAML::Hex);
-	if (combineImports)
-	{
-		QString resId = QString::number(resEntry.id, 16).rightJustified(8, '0').prepend("0x");
-		out << YAML::BeginMap // Resources
-			<< YAML::Key << resId.toStdString()
-			<< YAML::Value;
-	}
-	out << YAML::BeginSeq; // Imports
-	for (uint16_t j = 0; j < resEntry.importCount; ++j)
+	QString path = generateImportsPath(resEntry);
+	QByteArray imports;
+	appendImports(imports, resEntry);
+	if (!extractIndex.isEmpty())
 	{
-		ImportEntry impEntry = resEntry.imports[j];
-		QString impId = QString::number(impEntry.id, 16).rightJustified(8, '0').prepend("0x");
-		QString impOffset = QString::number(impEntry.offset, 16).rightJustified(8, '0').prepend("0x");
-		out << YAML::BeginMap // offset: id
-			<< YAML::Key << impOffset.toStdString()
-			<< YAML::Value << impId.toStdString()
-			<< YAML::EndMap; // offset: id
+		extractIndex[resIndex].files.append(path.sliced(outPath.size()));
+		extractIndex[resIndex].fileSizes.append(imports.size());
 	}
-	out << YAML::EndSeq; // Imports
-	if (!combineImports)
+	output->write(path, imports, group);
+}
+
+QString YAP::generateImportsPath(ResourceEntry& entry)
+{
+	QString path = generateFilePath(entry, 0);
+	if (path.endsWith(primarySuffix))
+		path.chop(primarySuffix.size());
+	else
+		path.chop(defaultSuffix.size());
+	return path + importsSuffix;
+}
+
+void YAP::appendImports(QByteArray& out, const ResourceEntry& resEntry)
+{
+	if (resEntry.imports.isEmpty()) // None, or primary portion not extracted
+		return;
+	// Each import is "- 0x<offset>: 0x<ID>", a line each
+	const char* separator = "\n";
+	out.reserve(out.size() + 0x10 + resEntry.imports.size() * 0x1A);
+	if (combineImports)
 	{
-		QString path = generateFilePath(resEntry, 0);
-		if (path.endsWith("_primary"))
-			path.chop(8);
-		importsFile.setFileName(path + importsSuffix);
-		if (!importsFile.open(QIODeviceBase::WriteOnly))
-		{
-			qWarning() << "Could not open file" << importsFile.fileName() << "for writing.";
-			return;
-		}
+		appendHex(out, resEntry.id, 8);
+		out.append(':');
+		separator = "\n  ";
 	}
-	else
+	for (qsizetype j = 0; j < resEntry.imports.size(); ++j)
 	{
-		out << YAML::EndMap // Resources
-			<< YAML::Newline;
-		importsFile.open(QIODeviceBase::WriteOnly | QIODeviceBase::Append);
+		if (combineImports || j > 0)
+			out.append(separator);
+		out.append("- ");
+		appendHex(out, resEntry.imports[j].offset, 8);
+		out.append(": ");
+		appendHex(out, resEntry.imports[j].id, 8);
 	}
-	importsFile.write(out.c_str());
-	importsFile.flush();
-	importsFile.close();
+	if (combineImports)
+		out.append('\n');
 }
 
 void YAP::outputDebugData(GameDataStream& stream, Bundle& bundle)
@@ -373,43 +665,37 @@ void YAP::outputDebugData(GameDataStream& stream, Bundle& bundle)
 	QString debugData;
 	stream.readString(debugData);
 
-	QFile file(outPath + debugDataFilename);
-	file.open(QIODeviceBase::WriteOnly);
-	file.write(debugData.toStdString().c_str());
-	file.flush();
-	file.close();
+	output->write(outPath + debugDataFilename, debugData.toUtf8());
 
 	std::cout << "Wrote debug data XML\n";
 }
 
-void YAP::outputMetadata(Bundle& bundle)
+void YAP::outputMetadata(Bundle& bundle, const QList<uint32_t>& selection)
 {
-	YAML::Emitter out;
-	out.SetIntBase(YAML::Hex);
-	out << YAML::BeginMap; // overarching structure
+	QByteArray out;
+	out.reserve(0xA0 + selection.size() * 0x60);
 
 	// Write bundle metadata
-	out << YAML::Key << "bundle"
-		<< YAML::Value
-		<< YAML::BeginMap // bundle
-		<< YAML::Key << "platform"
-		<< YAML::Value << YAML::Dec << bundle.platform // 1=pc, 2=x360, 3=ps3
-		<< YAML::Key << "compressed"
-		<< YAML::Value << (bool)((bundle.flags & (uint32_t)Bundle::Flags::IsCompressed))
-		<< YAML::Key << "mainMemOptimised"
-		<< YAML::Value << (bool)((bundle.flags & (uint32_t)Bundle::Flags::IsMainMemOptimised))
-		<< YAML::Key << "graphicsMemOptimised"
-		<< YAML::Value << (bool)((bundle.flags & (uint32_t)Bundle::Flags::IsGraphicsMemOptimised))
-		// Debug data flag excluded, determined by presence of .debug.xml
-		<< YAML::EndMap; // bundle
+	auto appendFlag = [&](const char* name, Bundle::Flags flag)
+	{
+		out.append("\n  ");
+		out.append(name);
+		out.append((bundle.flags & (uint32_t)flag) ? ": true" : ": false");
+	};
+	out.append("bundle:\n  platform: ");
+	appendDecimal(out, bundle.platform); // 1=pc, 2=x360, 3=ps3
+	appendFlag("compressed", Bundle::Flags::IsCompressed);
+	appendFlag("mainMemOptimised", Bundle::Flags::IsMainMemOptimised);
+	appendFlag("graphicsMemOptimised", Bundle::Flags::IsGraphicsMemOptimised);
+	// Debug data flag excluded, determined by presence of .debug.xml
 
 	// Write resource metadata
-	out << YAML::Key << "resources"
-		<< YAML::Value
-		<< YAML::BeginMap; // resources
-	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
+	out.append("\nresources:");
+	if (selection.isEmpty())
+		out.append("\n  {}");
+	for (uint32_t i : selection)
 	{
-		ResourceEntry entry = bundle.entries[i];
+		const ResourceEntry& entry = bundle.entries[i];
 
 		// Determine whether the resource has a secondary portion and, if so, which memory type it resides in
 		int secondaryMemoryType = -1;
@@ -419,37 +705,29 @@ void YAP::outputMetadata(Bundle& bundle)
 			secondaryMemoryType = 2;
 
 		// Resource ID, type
-		out << YAML::Key << QString::number(entry.id, 16).rightJustified(8, '0').prepend("0x").toStdString()
-			<< YAML::Value
-			<< YAML::BeginMap // resource details
-			<< YAML::Key << "type"
-			<< YAML::Value << entry.type;
+		out.append("\n  ");
+		appendHex(out, entry.id, 8);
+		out.append(":\n    type: ");
+		appendHex(out, entry.type);
 
 		if (secondaryMemoryType != -1)
 		{
 			// Secondary portion's memory type
-			out << YAML::Key << "secondaryMemoryType"
-				<< YAML::Value << YAML::Dec << secondaryMemoryType;
+			out.append("\n    secondaryMemoryType: ");
+			appendDecimal(out, secondaryMemoryType);
 		}
 
 		// Per memory type alignment
-		out << YAML::Key << "alignment"
-			<< YAML::Value
-			<< YAML::BeginSeq // alignment
-			<< (1 << ((entry.uncompressedInfo[0] & 0xF0000000) >> 28));
+		out.append("\n    alignment:\n      - ");
+		appendHex(out, 1 << ((entry.uncompressedInfo[0] & 0xF0000000) >> 28));
 		if (secondaryMemoryType != -1)
-			out << (1 << ((entry.uncompressedInfo[secondaryMemoryType] & 0xF0000000) >> 28));
-		out << YAML::EndSeq // alignment
-			<< YAML::EndMap; // resource details
+		{
+			out.append("\n      - ");
+			appendHex(out, 1 << ((entry.uncompressedInfo[secondaryMemoryType] & 0xF0000000) >> 28));
+		}
 	}
-	out << YAML::EndMap; // resources
-	out << YAML::EndMap; // overarching structure
-
-	QFile file(outPath + metadataFilename);
-	file.open(QIODeviceBase::WriteOnly);
-	file.write(out.c_str());
-	file.flush();
-	file.close();
+
+	output->write(outPath + metadataFilename, out);
 
 	std::cout << "Wrote metadata file\n";
 }
@@ -0,0 +1,199 @@
+#include <yap.h>
+#include <byte-order.h>
+#include <QByteArray>
+#include <utility>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define YAP_SSE2
+#endif
+
+// Imports files written by extraction are a small, regular subset of YAML,
+// one import per line:
+//   - 0x00000010: 0x1a2b3c4d
+// The combined file has the same lists under "0x<resource ID>:" keys. These
+// are scanned directly rather than building YAML nodes for every import.
+// Only lines of exactly these forms are accepted, indented by spaces alone
+// and by the same amount throughout each list, so the scan only takes text
+// that yaml-cpp reads as the same imports. Anything else, such as comments,
+// tabs, or other YAML syntax, makes the scan fail so the file is parsed with
+// yaml-cpp instead, which reports it if it's malformed.
+
+namespace
+{
+	const uint8_t invalidDigit = 0xFF;
+
+	inline uint8_t hexDigit(char c)
+	{
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		c |= 0x20;
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		return invalidDigit;
+	}
+
+	// Reads "0x" followed by up to 8 hex digits. Extraction always writes
+	// exactly 8, which are decoded together where SSE2 is available.
+	bool scanHex(const char*& pos, const char* end, uint32_t& value)
+	{
+		if (end - pos < 3 || pos[0] != '0' || (pos[1] != 'x' && pos[1] != 'X'))
+			return false;
+		pos += 2;
+#ifdef YAP_SSE2
+		if (end - pos >= 8 && (end - pos == 8 || hexDigit(pos[8]) == invalidDigit))
+		{
+			__m128i chars = _mm_loadl_epi64((const __m128i*)pos);
+			__m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+			__m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+				_mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+			__m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+				_mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+			if ((_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) & 0xFF) == 0xFF)
+			{
+				__m128i digits = _mm_or_si128(
+					_mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+					_mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+				// Each 16-bit lane holds a high then a low digit, which make one byte
+				__m128i bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(digits, _mm_set1_epi16(0xFF)), 4),
+					_mm_srli_epi16(digits, 8));
+				bytes = _mm_packus_epi16(bytes, bytes);
+				value = ByteOrder::swap((uint32_t)_mm_cvtsi128_si32(bytes)); // Most significant first
+				pos += 8;
+				return true;
+			}
+		}
+#endif
+		const char* start = pos;
+		value = 0;
+		for (; pos < end && hexDigit(*pos) != invalidDigit; ++pos)
+		{
+			if (pos - start == 8) // Out of range, left for yaml-cpp to report
+				return false;
+			value = value << 4 | hexDigit(*pos);
+		}
+		return pos != start;
+	}
+
+	inline void skipSpaces(const char*& pos, const char* end)
+	{
+		while (pos < end && *pos == ' ')
+			++pos;
+	}
+
+	// Moves to the start of the next line if only spaces are left on this one
+	bool scanLineEnd(const char*& pos, const char* end)
+	{
+		skipSpaces(pos, end);
+		if (pos < end && *pos == '\r')
+			++pos;
+		if (pos == end)
+			return true;
+		if (*pos != '\n')
+			return false;
+		++pos;
+		return true;
+	}
+
+	void skipBlankLines(const char*& pos, const char* end)
+	{
+		const char* line = pos;
+		while (scanLineEnd(line, end))
+		{
+			pos = line;
+			if (line == end)
+				return;
+		}
+	}
+
+	// "- 0xOFFSET: 0xID" after the same indentation as the rest of the list,
+	// which is set by the first item (-1 until then)
+	bool scanImport(const char*& pos, const char* end, qsizetype& indent, uint32_t& offset, uint32_t& id)
+	{
+		const char* lineStart = pos;
+		skipSpaces(pos, end);
+		if (indent == -1)
+			indent = pos - lineStart;
+		else if (pos - lineStart != indent)
+			return false;
+		if (end - pos < 2 || pos[0] != '-' || pos[1] != ' ')
+			return false;
+		pos += 2;
+		skipSpaces(pos, end);
+		if (!scanHex(pos, end, offset) || end - pos < 2 || pos[0] != ':' || pos[1] != ' ')
+			return false;
+		pos += 2;
+		skipSpaces(pos, end);
+		return scanHex(pos, end, id) && id != 0 && scanLineEnd(pos, end);
+	}
+}
+
+// Reads a per-resource imports file, returning false if it must be parsed
+// as YAML instead
+bool YAP::scanImports(const QByteArray& text, QList<ImportEntry>& imports)
+{
+	const char* pos = text.constData();
+	const char* end = pos + text.size();
+	QList<ImportEntry> scanned;
+	qsizetype indent = -1;
+	for (skipBlankLines(pos, end); pos < end; skipBlankLines(pos, end))
+	{
+		uint32_t offset = 0;
+		uint32_t id = 0;
+		if (!scanImport(pos, end, indent, offset, id))
+			return false;
+		scanned.append(ImportEntry{ id, offset });
+	}
+	if (scanned.isEmpty()) // Not a sequence
+		return false;
+	imports = std::move(scanned);
+	return true;
+}
+
+// Reads the combined imports file into lists by resource ID, returning false
+// if it must be parsed as YAML instead. As when parsing, the first list for
+// a resource is the one used.
+bool YAP::scanCombinedImports(const QByteArray& text, QHash<uint64_t, QList<ImportEntry>>& lists)
+{
+	const char* pos = text.constData();
+	const char* end = pos + text.size();
+	QHash<uint64_t, QList<ImportEntry>> scanned;
+	bool inList = false;
+	uint32_t listId = 0;
+	QList<ImportEntry> list;
+	qsizetype indent = -1; // Of the current list
+	auto finishList = [&]
+	{
+		if (!inList)
+			return true;
+		if (list.isEmpty())
+			return false;
+		if (!scanned.contains(listId))
+			scanned.insert(listId, list);
+		list.clear();
+		indent = -1;
+		return true;
+	};
+	for (skipBlankLines(pos, end); pos < end; skipBlankLines(pos, end))
+	{
+		if (*pos == '0') // Unindented "0xID:" starting the next list
+		{
+			if (!finishList() || !scanHex(pos, end, listId) || listId == 0
+				|| pos == end || *pos != ':')
+				return false;
+			++pos;
+			if (!scanLineEnd(pos, end))
+				return false;
+			inList = true;
+			continue;
+		}
+		uint32_t offset = 0;
+		uint32_t id = 0;
+		if (!inList || !scanImport(pos, end, indent, offset, id))
+			return false;
+		list.append(ImportEntry{ id, offset });
+	}
+	if (!finishList() || scanned.isEmpty()) // Not a map
+		return false;
+	lists = std::move(scanned);
+	return true;
+}
@@ -0,0 +1,341 @@
+#include <yap.h>
+#include <QFile>
+#include <QDateTime>
+#include <QFileInfo>
+#include <iostream>
+
+// The index records what was extracted from each resource so re-extracting
+// an updated bundle only has to write what changed, and so creating a bundle
+// from an untouched folder can skip parsing the metadata and finding files.
+// Layout (little endian):
+// "YAPI", version, platform, bundle flags, whether imports were combined, the
+// size and modified time of the metadata and combined imports files, entry
+// count, then per entry: ID, type, uncompressed info, compressed sizes, data
+// hashes, imports, and the files written with their sizes and modified times.
+
+bool YAP::loadIndex(const QString& path, IndexHeader& header, QList<IndexEntry>& entries)
+{
+	QFile file(path);
+	if (!file.open(QIODeviceBase::ReadOnly))
+		return false;
+	GameDataStream stream(&file);
+	QString magic;
+	uint32_t version = 0;
+	uint8_t combinedImports = 0;
+	uint32_t count = 0;
+	stream.readString(magic, 4);
+	stream >> version;
+	if (magic != "YAPI" || version != indexVersion)
+		return false;
+	stream >> header.platform;
+	stream >> header.flags;
+	stream >> combinedImports;
+	header.combinedImports = combinedImports != 0;
+	stream >> header.metadataSize;
+	stream >> header.metadataTime;
+	stream >> header.importsSize;
+	stream >> header.importsTime;
+	stream >> count;
+
+	entries.reserve(count);
+	for (uint32_t i = 0; i < count && !file.atEnd(); ++i)
+	{
+		IndexEntry entry;
+		stream >> entry.id;
+		stream >> entry.type;
+		for (int j = 0; j < 3; ++j)
+			stream >> entry.uncompressedInfo[j];
+		for (int j = 0; j < 3; ++j)
+			stream >> entry.compressedSize[j];
+		for (int j = 0; j < 3; ++j)
+			stream >> entry.dataHash[j];
+		uint16_t importCount = 0;
+		stream >> importCount;
+		entry.imports.resize(importCount);
+		for (uint16_t j = 0; j < importCount; ++j)
+		{
+			stream >> entry.imports[j].id;
+			stream >> entry.imports[j].offset;
+		}
+		uint16_t fileCount = 0;
+		stream >> fileCount;
+		for (uint16_t j = 0; j < fileCount; ++j)
+		{
+			uint16_t length = 0;
+			QString filePath;
+			int64_t size = 0;
+			int64_t modifiedTime = 0;
+			stream >> length;
+			stream.readString(filePath, length);
+			stream >> size;
+			stream >> modifiedTime;
+			entry.files.append(filePath);
+			entry.fileSizes.append(size);
+			entry.fileTimes.append(modifiedTime);
+		}
+		entries.append(entry);
+	}
+	file.close();
+	return entries.size() == count;
+}
+
+void YAP::readIndex()
+{
+	if (!QFileInfo(outPath + indexFilename).exists())
+		return;
+	IndexHeader header;
+	QList<IndexEntry> entries;
+	if (!loadIndex(outPath + indexFilename, header, entries))
+	{
+		qWarning() << "Could not read the index file. Extracting all resources.";
+		return;
+	}
+	previousIndex.reserve(entries.size());
+	for (const IndexEntry& entry : entries)
+		previousIndex.insert(entry.id, entry);
+	std::cout << "Read index of previous extraction\n";
+}
+
+void YAP::writeIndex(Bundle& bundle, const QList<uint32_t>& selection)
+{
+	QFile file(outPath + indexFilename);
+	if (!file.open(QIODeviceBase::WriteOnly))
+	{
+		qWarning() << "Could not write the index file.";
+		return;
+	}
+	// Everything has been written by now, so modified times are final
+	QFileInfo metadataInfo(outPath + metadataFilename);
+	QFileInfo importsInfo(outPath + importsFilename);
+	GameDataStream stream(&file);
+	stream.writeString(QString("YAPI"));
+	stream << indexVersion;
+	stream << bundle.platform;
+	stream << bundle.flags;
+	stream << (uint8_t)combineImports;
+	stream << (int64_t)metadataInfo.size();
+	stream << (int64_t)metadataInfo.lastModified().toMSecsSinceEpoch();
+	stream << (int64_t)(combineImports ? importsInfo.size() : 0);
+	stream << (int64_t)(combineImports ? importsInfo.lastModified().toMSecsSinceEpoch() : 0);
+	stream << (uint32_t)selection.size();
+	for (uint32_t index : selection)
+	{
+		const IndexEntry& entry = extractIndex[index];
+		// Imports of unchanged resources were taken from the previous index
+		const QList<ImportEntry>& imports = bundle.entries[index].imports;
+		stream << entry.id;
+		stream << entry.type;
+		for (int j = 0; j < 3; ++j)
+			stream << entry.uncompressedInfo[j];
+		for (int j = 0; j < 3; ++j)
+			stream << entry.compressedSize[j];
+		for (int j = 0; j < 3; ++j)
+			stream << entry.dataHash[j];
+		stream << (uint16_t)imports.size();
+		for (const ImportEntry& import : imports)
+		{
+			stream << import.id;
+			stream << import.offset;
+		}
+		stream << (uint16_t)entry.files.size();
+		for (int j = 0; j < entry.files.size(); ++j)
+		{
+			stream << (uint16_t)entry.files[j].size();
+			stream.writeString(entry.files[j]);
+			stream << (int64_t)entry.fileSizes[j];
+			stream << (int64_t)QFileInfo(outPath + entry.files[j]).lastModified().toMSecsSinceEpoch();
+		}
+	}
+	file.close();
+}
+
+// Uses the index instead of the metadata if nothing in the input folder has
+// changed since it was extracted. Files the index lists are checked with one
+// stat each, then the folder is walked to make sure no resource has gained a
+// file, such as a new imports file or a duplicate, that the metadata path
+// would use or reject. Both cost far less than parsing the metadata.
+bool YAP::readCreateIndex()
+{
+	if (inputIsArchive || !QFileInfo(inPath + indexFilename).exists())
+		return false;
+	IndexHeader header;
+	QList<IndexEntry> entries;
+	if (!loadIndex(inPath + indexFilename, header, entries))
+		return false;
+
+	auto unchanged = [](const QString& path, qint64 size, qint64 modifiedTime)
+	{
+		QFileInfo info(path);
+		return info.exists() && info.size() == size
+			&& info.lastModified().toMSecsSinceEpoch() == modifiedTime;
+	};
+	if (!unchanged(inPath + metadataFilename, header.metadataSize, header.metadataTime))
+		return false;
+	// Creation uses the combined imports file whenever it exists
+	if (header.combinedImports
+		? !unchanged(inPath + importsFilename, header.importsSize, header.importsTime)
+		: QFileInfo(inPath + importsFilename).exists())
+		return false;
+
+	QList<QStringList> files;
+	files.reserve(entries.size());
+	for (const IndexEntry& entry : entries)
+	{
+		QStringList paths = { "", "", "" };
+		for (int i = 0; i < entry.files.size(); ++i)
+		{
+			if (!unchanged(inPath + entry.files[i], entry.fileSizes[i], entry.fileTimes[i]))
+				return false;
+			int slot = entry.files[i].endsWith(importsSuffix) ? 2 : entry.files[i].endsWith(secondarySuffix) ? 1 : 0;
+			paths[slot] = inPath + entry.files[i];
+		}
+		// Every portion must have been extracted
+		if (paths[0].isEmpty()
+			|| (paths[1].isEmpty() && (entry.compressedSize[1] != 0 || entry.compressedSize[2] != 0))
+			|| (paths[2].isEmpty() && !header.combinedImports && !entry.imports.isEmpty()))
+			return false;
+		files.append(paths);
+	}
+
+	// Left in place if anything differs, so the metadata path needn't walk the
+	// folder again
+	indexInputFiles();
+	for (qsizetype i = 0; i < entries.size(); ++i)
+	{
+		InputFiles found = inputFiles.value(entries[i].id);
+		QStringList foundPaths = found.primary + found.secondary;
+		if (!header.combinedImports) // Ignored when creating otherwise
+			foundPaths += found.imports;
+		QStringList listedPaths;
+		for (const QString& path : files[i])
+		{
+			if (!path.isEmpty())
+				listedPaths.append(QFileInfo(path).absoluteFilePath());
+		}
+		foundPaths.sort();
+		listedPaths.sort();
+		if (foundPaths != listedPaths)
+			return false;
+	}
+	inputFiles.clear();
+
+	indexHeader = header;
+	indexedResources = entries;
+	resourceFiles = files;
+	return true;
+}
+
+bool YAP::indexResource(ExtractWorker& worker, Bundle& bundle, int index)
+{
+	ResourceEntry& entry = bundle.entries[index];
+	IndexEntry& indexEntry = extractIndex[index];
+	indexEntry.id = entry.id;
+	indexEntry.type = entry.type;
+	for (int i = 0; i < 3; ++i)
+	{
+		indexEntry.uncompressedInfo[i] = entry.uncompressedInfo[i];
+		indexEntry.compressedSize[i] = entry.compressedSize[i];
+	}
+	// Hashes are only compared by incremental extraction, so they aren't worth
+	// a pass over all the data otherwise. An index without them just makes the
+	// first incremental extraction write everything.
+	if (!incremental)
+		return false;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (entry.compressedSize[i] != 0 && selectedMemoryTypes[i])
+			indexEntry.dataHash[i] = hashPortion(worker, bundle, entry, i);
+	}
+
+	auto it = previousIndex.constFind(entry.id);
+	if (it == previousIndex.cend())
+		return false;
+	const IndexEntry& previous = it.value();
+	if (previous.type != indexEntry.type)
+		return false;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (previous.uncompressedInfo[i] != indexEntry.uncompressedInfo[i]
+			|| previous.compressedSize[i] != indexEntry.compressedSize[i]
+			|| previous.dataHash[i] != indexEntry.dataHash[i])
+			return false;
+	}
+
+	// The files must be the ones this extraction would write, and untouched
+	QStringList expectedFiles;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (entry.compressedSize[i] != 0 && selectedMemoryTypes[i])
+			expectedFiles.append(generateFilePath(entry, i).sliced(outPath.size()));
+	}
+	if (!combineImports && entry.importCount > 0 && selectedMemoryTypes[0])
+		expectedFiles.append(generateImportsPath(entry).sliced(outPath.size()));
+	if (expectedFiles != previous.files)
+		return false;
+	for (int i = 0; i < previous.files.size(); ++i)
+	{
+		QFileInfo info(outPath + previous.files[i]);
+		if (!info.exists() || info.size() != previous.fileSizes[i]
+			|| info.lastModified().toMSecsSinceEpoch() != previous.fileTimes[i])
+			return false;
+	}
+
+	indexEntry.files = previous.files;
+	indexEntry.fileSizes = previous.fileSizes;
+	indexEntry.unchanged = true;
+	entry.imports = previous.imports; // Needed for the combined imports file
+	return true;
+}
+
+uint64_t YAP::hashPortion(ExtractWorker& worker, Bundle& bundle, ResourceEntry& entry, int memType)
+{
+	// Hash the data as stored in the bundle so unchanged resources never need
+	// to be decompressed
+	qint64 dataOffset = (qint64)entry.offset[memType] + bundle.resourceData[memType];
+	uint32_t size = entry.compressedSize[memType];
+	const char* data = nullptr;
+	if (mappedBundle != nullptr)
+	{
+		if (dataOffset + size > mappedBundleSize)
+			return 0; // Will fail to extract anyway
+		data = (const char*)mappedBundle + dataOffset;
+	}
+	else
+	{
+		// Kept for extraction in case the resource has changed
+		worker.readBuffer[memType].resize(size);
+		worker.stream->seek(dataOffset);
+		worker.stream->device()->read(worker.readBuffer[memType].data(), size);
+		worker.readAhead[memType] = true;
+		data = worker.readBuffer[memType].constData();
+	}
+	return ((uint64_t)libdeflate_crc32(0, data, size) << 32) | libdeflate_adler32(1, data, size);
+}
+
+void YAP::removeStaleFiles(const QList<uint32_t>& selection)
+{
+	QSet<QString> currentFiles;
+	for (uint32_t index : selection)
+	{
+		for (const QString& path : extractIndex[index].files)
+			currentFiles.insert(path);
+	}
+
+	int removedCount = 0;
+	int unchangedCount = 0;
+	for (uint32_t index : selection)
+	{
+		if (extractIndex[index].unchanged)
+			++unchangedCount;
+	}
+	for (auto it = previousIndex.cbegin(); it != previousIndex.cend(); ++it)
+	{
+		for (const QString& path : it.value().files)
+		{
+			if (!currentFiles.contains(path) && QFile::remove(outPath + path))
+				++removedCount;
+		}
+	}
+	std::cout << "Skipped " << unchangedCount << " unchanged resources, removed "
+		<< removedCount << " stale files\n";
+}
@@ -0,0 +1,216 @@
+#include <yap.h>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <algorithm>
+
+namespace
+{
+	// The contents of a JSON string, with quotes, backslashes, and control
+	// characters escaped
+	QString escapeJson(const QString& value)
+	{
+		QString escaped;
+		escaped.reserve(value.size());
+		for (qsizetype i = 0; i < value.size(); ++i)
+		{
+			char16_t c = value[i].unicode();
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+				escaped += value[i];
+			}
+			else if (c == '\n')
+				escaped += "\\n";
+			else if (c == '\r')
+				escaped += "\\r";
+			else if (c == '\t')
+				escaped += "\\t";
+			else if (c < 0x20)
+				escaped += "\\u" + QString::number(c, 16).rightJustified(4, '0');
+			else
+				escaped += value[i];
+		}
+		return escaped;
+	}
+
+	// A CSV field, quoted as RFC 4180 describes if it contains a separator,
+	// quote, or line break
+	QString escapeCsv(const QString& value)
+	{
+		for (qsizetype i = 0; i < value.size(); ++i)
+		{
+			char16_t c = value[i].unicode();
+			if (c == ',' || c == '"' || c == '\r' || c == '\n')
+				return '"' + QString(value).replace("\"", "\"\"") + '"';
+		}
+		return value;
+	}
+}
+
+int YAP::list()
+{
+	// A folder is searched for bundles, anything without the bundle magic is skipped
+	QStringList bundlePaths;
+	bool searchedFolder = QFileInfo(inPath).isDir();
+	if (searchedFolder)
+	{
+		QDirIterator it(inPath, QDir::Files, QDirIterator::Subdirectories);
+		while (it.hasNext())
+			bundlePaths.append(it.next());
+		std::sort(bundlePaths.begin(), bundlePaths.end());
+	}
+	else
+	{
+		bundlePaths.append(inPath);
+	}
+
+	QFile outFile;
+	if (!outPath.isEmpty())
+	{
+		outFile.setFileName(outPath);
+		outFile.open(QIODeviceBase::WriteOnly);
+	}
+	else
+	{
+		outFile.open(stdout, QIODeviceBase::WriteOnly);
+	}
+	QTextStream out(&outFile);
+
+	if (listFormat == "json")
+		out << "[";
+	else if (listFormat == "csv")
+		out << "bundle,id,type,typeName,importCount,memoryTypes,"
+			<< "uncompressedSize0,uncompressedSize1,uncompressedSize2,"
+			<< "compressedSize0,compressedSize1,compressedSize2,ratio\n";
+
+	int result = 0;
+	int listedCount = 0;
+	for (const QString& path : bundlePaths)
+	{
+		QFile file(path);
+		if (!file.open(QIODeviceBase::ReadOnly))
+		{
+			qWarning().noquote() << "Could not open" << path << "for reading.";
+			result = 2;
+			continue;
+		}
+		if (searchedFolder && file.peek(4) != "bnd2")
+			continue;
+
+		GameDataStream stream(&file);
+		if (!validateBundle(stream))
+		{
+			result = 2;
+			continue;
+		}
+		setShaderTypeName(stream);
+		Bundle bundle;
+		readBundle(stream, bundle);
+		file.close();
+		if (!validateResourceEntries(bundle))
+		{
+			result = 3;
+			continue;
+		}
+		listBundle(out, path, bundle, listedCount++ == 0);
+	}
+
+	if (listFormat == "json")
+		out << "\n]\n";
+	out.flush();
+	outFile.close();
+
+	return result;
+}
+
+void YAP::listBundle(QTextStream& out, const QString& path, Bundle& bundle, bool first)
+{
+	auto hex = [](uint64_t value, int width = 0)
+	{
+		return QString::number(value, 16).rightJustified(width, '0').prepend("0x");
+	};
+
+	if (listFormat == "json")
+	{
+		out << (first ? "\n" : ",\n")
+			<< "  {\n"
+			<< "    \"path\": \"" << escapeJson(path) << "\",\n"
+			<< "    \"platform\": " << bundle.platform << ",\n"
+			<< "    \"compressed\": " << ((bundle.flags & (uint32_t)Bundle::Flags::IsCompressed) ? "true" : "false") << ",\n"
+			<< "    \"mainMemOptimised\": " << ((bundle.flags & (uint32_t)Bundle::Flags::IsMainMemOptimised) ? "true" : "false") << ",\n"
+			<< "    \"graphicsMemOptimised\": " << ((bundle.flags & (uint32_t)Bundle::Flags::IsGraphicsMemOptimised) ? "true" : "false") << ",\n"
+			<< "    \"containsDebugData\": " << ((bundle.flags & (uint32_t)Bundle::Flags::ContainsDebugData) ? "true" : "false") << ",\n"
+			<< "    \"resourceCount\": " << bundle.resourceCount << ",\n"
+			<< "    \"resources\": [";
+	}
+	else if (listFormat == "text")
+	{
+		if (!first)
+			out << "\n";
+		out << path << "\n"
+			<< "Platform " << bundle.platform << ", flags " << hex(bundle.flags)
+			<< ", " << bundle.resourceCount << " resources\n"
+			<< "ID          " << QString("Type").leftJustified(32)
+			<< "Imports  Memory  " << QString("Uncompressed").leftJustified(14)
+			<< QString("Compressed").leftJustified(14) << "Ratio\n";
+	}
+
+	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
+	{
+		const ResourceEntry& entry = bundle.entries[i];
+		QString typeName = resourceTypes.value(entry.type);
+		QStringList memoryTypes;
+		uint64_t uncompressedTotal = 0;
+		uint64_t compressedTotal = 0;
+		for (int j = 0; j < 3; ++j)
+		{
+			if (entry.compressedSize[j] != 0)
+				memoryTypes.append(QString::number(j));
+			uncompressedTotal += entry.uncompressedInfo[j] & 0x0FFFFFFF;
+			compressedTotal += entry.compressedSize[j];
+		}
+		double ratio = uncompressedTotal == 0 ? 0 : (double)compressedTotal / uncompressedTotal;
+
+		if (listFormat == "json")
+		{
+			out << (i == 0 ? "\n" : ",\n")
+				<< "      { \"id\": \"" << hex(entry.id, 8) << "\""
+				<< ", \"type\": " << entry.type
+				<< ", \"typeName\": \"" << escapeJson(typeName) << "\""
+				<< ", \"importCount\": " << entry.importCount
+				<< ", \"memoryTypes\": [" << memoryTypes.join(", ") << "]"
+				<< ", \"uncompressedSize\": [";
+			for (int j = 0; j < 3; ++j)
+				out << (j == 0 ? "" : ", ") << (entry.uncompressedInfo[j] & 0x0FFFFFFF);
+			out << "], \"compressedSize\": [";
+			for (int j = 0; j < 3; ++j)
+				out << (j == 0 ? "" : ", ") << entry.compressedSize[j];
+			out << "], \"ratio\": " << QString::number(ratio, 'f', 4) << " }";
+		}
+		else if (listFormat == "csv")
+		{
+			out << escapeCsv(path) << "," << hex(entry.id, 8) << "," << hex(entry.type) << "," << escapeCsv(typeName)
+				<< "," << entry.importCount << "," << memoryTypes.join(' ');
+			for (int j = 0; j < 3; ++j)
+				out << "," << (entry.uncompressedInfo[j] & 0x0FFFFFFF);
+			for (int j = 0; j < 3; ++j)
+				out << "," << entry.compressedSize[j];
+			out << "," << QString::number(ratio, 'f', 4) << "\n";
+		}
+		else
+		{
+			QString type = typeName.isEmpty() ? hex(entry.type) : typeName + " (" + hex(entry.type) + ")";
+			out << hex(entry.id, 8) << "  " << type.leftJustified(32)
+				<< QString::number(entry.importCount).leftJustified(9)
+				<< memoryTypes.join(',').leftJustified(8)
+				<< hex(uncompressedTotal).leftJustified(14)
+				<< hex(compressedTotal).leftJustified(14)
+				<< QString::number(ratio, 'f', 4) << "\n";
+		}
+	}
+
+	if (listFormat == "json")
+		out << (bundle.resourceCount == 0 ? "]\n  }" : "\n    ]\n  }");
+}
@@ -0,0 +1,148 @@
+#include <output-queue.h>
+#include <tar.h>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+OutputQueue::OutputQueue(int threadCount, qint64 maxPendingBytes)
+	: maxPendingBytes(maxPendingBytes)
+{
+	for (int i = 0; i < threadCount; ++i)
+		threads.emplace_back(&OutputQueue::run, this);
+}
+
+OutputQueue::OutputQueue(QIODevice* archive, qint64 modifiedTime, qint64 maxPendingBytes)
+	: maxPendingBytes(maxPendingBytes)
+{
+	tar = new TarWriter(archive, modifiedTime);
+	threads.emplace_back(&OutputQueue::run, this);
+}
+
+OutputQueue::~OutputQueue()
+{
+	finish();
+	delete tar;
+}
+
+void OutputQueue::write(const QString& path, QByteArray data, int group)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	// Always let a job through if nothing is pending so huge files can't
+	// deadlock, and never hold up the group the archive is waiting on
+	jobDone.wait(lock, [&]
+	{
+		return pendingBytes == 0 || pendingBytes + data.size() <= maxPendingBytes
+			|| (tar != nullptr && group == nextGroup);
+	});
+	pendingBytes += data.size();
+	if (tar != nullptr && group >= 0)
+	{
+		groupedJobs[group].push_back({ path, std::move(data) });
+		return;
+	}
+	jobs.push_back({ path, std::move(data) });
+	jobAdded.notify_one();
+}
+
+QByteArray OutputQueue::takeBuffer()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (freeBuffers.empty())
+		return QByteArray();
+	QByteArray buffer = std::move(freeBuffers.back());
+	freeBuffers.pop_back();
+	return buffer;
+}
+
+void OutputQueue::closeGroup(int group)
+{
+	if (tar == nullptr)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closedGroups.insert(group);
+		while (closedGroups.contains(nextGroup))
+		{
+			auto it = groupedJobs.find(nextGroup);
+			if (it != groupedJobs.end())
+			{
+				for (Job& job : it->second)
+					jobs.push_back(std::move(job));
+				groupedJobs.erase(it);
+			}
+			closedGroups.erase(nextGroup++);
+		}
+	}
+	jobAdded.notify_all();
+	jobDone.notify_all(); // Writers for the new next group may be waiting
+}
+
+void OutputQueue::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (finishing)
+			return;
+		finishing = true;
+	}
+	jobAdded.notify_all();
+	for (std::thread& thread : threads)
+		thread.join();
+	threads.clear();
+	if (tar != nullptr)
+		tar->finish();
+}
+
+void OutputQueue::run()
+{
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobAdded.wait(lock, [&] { return !jobs.empty() || finishing; });
+			if (jobs.empty()) // Finishing and nothing left
+				return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		if (tar != nullptr)
+		{
+			if (!tar->addFile(job.path, job.data))
+				qWarning() << "Could not write file" << job.path << "to the archive.";
+		}
+		else
+		{
+			ensureDirectory(job.path.left(job.path.lastIndexOf('/') + 1));
+			QFile file(job.path);
+			if (!file.open(QIODeviceBase::WriteOnly))
+				qWarning() << "Could not open file" << job.path << "for writing.";
+			else
+			{
+				file.write(job.data);
+				file.close();
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pendingBytes -= job.data.size();
+			// Keep buffers nobody else holds (not raw data) for reuse
+			if (job.data.isDetached() && job.data.capacity() > 0 && freeBuffers.size() < 64)
+				freeBuffers.push_back(std::move(job.data));
+		}
+		jobDone.notify_all();
+	}
+}
+
+void OutputQueue::ensureDirectory(const QString& path)
+{
+	if (path.isEmpty())
+		return;
+	std::lock_guard<std::mutex> lock(directoryMutex);
+	if (createdDirectories.contains(path))
+		return;
+	QDir().mkpath(path);
+	createdDirectories.insert(path);
+}
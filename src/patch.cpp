@@ -0,0 +1,364 @@
+#include <yap.h>
+#include <import-codec.h>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <algorithm>
+#include <iostream>
+
+// Patching replaces resources in an existing bundle with files named as
+// extraction writes them: <ID>.dat or <ID>_header.dat, <ID>_body.dat, and
+// <ID>_imports.yaml, or the combined imports file instead of the last, as when
+// creating. Only the replaced portions are compressed and written,
+// along with their entries and the header. Other resources are left as they
+// are on disk. A portion that still fits where it was is rewritten in place,
+// otherwise it moves to the end of its memory type's data, and the data of
+// later memory types is only moved when there isn't enough padding before it.
+
+int YAP::patch()
+{
+	QElapsedTimer timer;
+	timer.start();
+	QFile file(outPath);
+	GameDataStream stream(&file);
+	file.open(QIODeviceBase::ReadWrite);
+	if (!validateBundle(stream))
+		return 2;
+	setShaderTypeName(stream);
+	Bundle bundle;
+	readBundle(stream, bundle);
+	if (!validateResourceEntries(bundle))
+		return 3;
+	if (!resolveTypeLevels())
+		return 2;
+	createDecompressor();
+	createCompressor();
+
+	indexInputFiles();
+	QHash<uint64_t, QList<ImportEntry>> combinedImports;
+	bool usingCombinedFile = inputExists(inPath + importsFilename);
+	if (usingCombinedFile && !readCombinedPatchImports(combinedImports))
+		return 5;
+	QList<uint64_t> ids = inputFiles.keys();
+	for (auto it = combinedImports.cbegin(); it != combinedImports.cend(); ++it)
+	{
+		if (!inputFiles.contains(it.key()))
+			ids.append(it.key());
+	}
+	std::sort(ids.begin(), ids.end());
+	if (ids.isEmpty())
+	{
+		qWarning() << "No resource files found to patch.";
+		return 0;
+	}
+	QHash<uint64_t, uint32_t> indices;
+	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
+		indices.insert(bundle.entries[i].id, i);
+
+	// Everything is read and compressed before anything is written, so a bad
+	// file leaves the bundle untouched
+	CreateWorker worker;
+	worker.compressors[compressionLevel] = cmp;
+	worker.parallelLevels = jobs > 1; // Resources are prepared one at a time
+	QList<uint32_t> patchedIndices;
+	QList<ResourceEntry> patchedEntries;
+	QList<QList<QByteArray>> patchedPortions;
+	bool prepared = true;
+	for (uint64_t id : ids)
+	{
+		if (!indices.contains(id))
+		{
+			qCritical().noquote().nospace() << "Resource 0x" << QString::number(id, 16).toUpper().rightJustified(8, '0')
+				<< " is not in the bundle. Resources can only be replaced, not added. Aborting.";
+			prepared = false;
+			break;
+		}
+		uint32_t index = indices.value(id);
+		ResourceEntry patched = bundle.entries[index];
+		QList<QByteArray> portions(3);
+		std::cout << "\rPreparing resource " << patchedIndices.size() + 1 << "/" << ids.size() << std::flush;
+		if (!preparePatch(stream, bundle, worker, patched, inputFiles.value(id),
+			usingCombinedFile ? &combinedImports : nullptr, portions))
+		{
+			prepared = false;
+			break;
+		}
+		patchedIndices.append(index);
+		patchedEntries.append(patched);
+		patchedPortions.append(portions);
+	}
+	for (libdeflate_compressor* compressor : worker.compressors)
+	{
+		if (compressor != nullptr && compressor != cmp)
+			libdeflate_free_compressor(compressor);
+	}
+	std::cout << '\n';
+	if (!prepared)
+		return 5;
+
+	uint64_t writtenBytes = 0;
+	for (qsizetype i = 0; i < patchedIndices.size(); ++i)
+	{
+		uint32_t index = patchedIndices[i];
+		for (int memType = 0; memType < 3; ++memType)
+		{
+			const QByteArray& portion = patchedPortions[i][memType];
+			if (portion.isNull())
+				continue;
+			placePortion(stream, bundle, index, memType, portion);
+			writtenBytes += portion.size();
+		}
+		ResourceEntry& entry = bundle.entries[index];
+		const ResourceEntry& patched = patchedEntries[i];
+		for (int memType = 0; memType < 3; ++memType)
+			entry.uncompressedInfo[memType] = patched.uncompressedInfo[memType];
+		entry.importsOffset = patched.importsOffset;
+		entry.importCount = patched.importCount;
+		entry.importsHash = patched.importsHash;
+		writeResourceEntries(stream, bundle, index, 1);
+	}
+	writeBundleHeader(stream, bundle);
+	stream.close();
+	if (!cachePath.isEmpty())
+		std::cout << "Reused " << worker.cacheHits << " portions from the cache\n";
+	std::cout << "Patched " << patchedIndices.size() << " resources, writing " << writtenBytes
+		<< " bytes of resource data in " << timer.elapsed() << "ms";
+	return 0;
+}
+
+// Every list in the combined imports file replaces that resource's imports
+bool YAP::readCombinedPatchImports(QHash<uint64_t, QList<ImportEntry>>& lists)
+{
+	QByteArray importsText = readInput(inPath + importsFilename);
+	if (scanCombinedImports(importsText, lists))
+		return true;
+	YAML::Node importsFile = YAML::Load(std::string(importsText.constData(), importsText.size()));
+	if (!importsFile.IsMap())
+	{
+		qCritical() << "Expected imports node type to be map. Aborting.";
+		return false;
+	}
+	for (YAML::const_iterator importsList = importsFile.begin();
+		importsList != importsFile.end(); ++importsList)
+	{
+		uint64_t resId = 0;
+		std::string resourceKey = importsList->first.as<std::string>();
+		if (!validateResourceIdKey(resourceKey, resId))
+			return false;
+		if (lists.contains(resId)) // First list wins
+			continue;
+		QList<ImportEntry> imports;
+		if (!parseImports(importsList->second, resourceKey, imports))
+			return false;
+		lists.insert(resId, imports);
+	}
+	return true;
+}
+
+// Reads the replacement files for one resource into a copy of its entry and
+// the portions to write. Whatever isn't replaced comes from the bundle. If
+// the combined imports file is used, it replaces per-resource ones.
+bool YAP::preparePatch(GameDataStream& stream, Bundle& bundle, CreateWorker& worker, ResourceEntry& patched,
+	const InputFiles& files, const QHash<uint64_t, QList<ImportEntry>>* combinedImports,
+	QList<QByteArray>& portions)
+{
+	QString resourceKey = "0x" + QString::number(patched.id, 16).toUpper().rightJustified(8, '0');
+	if (files.primary.size() > 1 || files.secondary.size() > 1
+		|| (combinedImports == nullptr && files.imports.size() > 1))
+	{
+		qCritical().noquote() << "Resource" << resourceKey << "has more than one replacement file"
+			<< "of the same kind. Aborting.";
+		return false;
+	}
+	int secondaryMemType = patched.compressedSize[1] != 0 ? 1 : patched.compressedSize[2] != 0 ? 2 : -1;
+	if (!files.secondary.isEmpty() && secondaryMemType == -1)
+	{
+		qCritical().noquote() << "Resource" << resourceKey
+			<< "has no secondary portion to replace. Aborting.";
+		return false;
+	}
+
+	// Imports
+	bool replaceImports = combinedImports != nullptr ? combinedImports->contains(patched.id) : !files.imports.isEmpty();
+	bool replacePrimary = !files.primary.isEmpty();
+	QByteArray primaryData;
+	if (replaceImports && combinedImports != nullptr)
+		patched.imports = combinedImports->value(patched.id);
+	else if (replaceImports)
+	{
+		QByteArray importsText = readInput(files.imports.first());
+		QList<ImportEntry> imports;
+		if (!scanImports(importsText, imports)
+			&& !parseImports(YAML::Load(std::string(importsText.constData(), importsText.size())),
+				resourceKey.toStdString(), imports))
+			return false;
+		patched.imports = imports;
+	}
+	if (replacePrimary)
+		primaryData = readInput(files.primary.first());
+	// The half of the primary portion that isn't replaced is kept
+	if (replacePrimary != replaceImports && (replaceImports || patched.importCount > 0))
+	{
+		QByteArray resource = readBundlePortion(stream, bundle, patched, 0);
+		if (resource.isNull())
+			return false;
+		ResourceEntry existing = patched;
+		uint32_t dataSize = readImports(bundle, existing, resource);
+		if (!replaceImports)
+			patched.imports = existing.imports;
+		else
+			primaryData = resource.first(dataSize);
+	}
+
+	// Primary portion
+	if (replacePrimary || replaceImports)
+	{
+		for (const ImportEntry& import : patched.imports)
+		{
+			if (import.offset > primaryData.size())
+			{
+				qCritical().noquote().nospace() << "Resource " << resourceKey
+					<< ": Import offset 0x" << QString::number(import.offset, 16) << " out of range. Aborting.";
+				return false;
+			}
+		}
+		patched.importCount = patched.imports.size();
+		patched.importsOffset = patched.importCount > 0 ? primaryData.size() : 0;
+		patched.importsHash = 0;
+		for (const ImportEntry& import : patched.imports)
+			patched.importsHash |= import.id;
+		if (patched.importCount > 0)
+		{
+			qsizetype dataSize = primaryData.size();
+			primaryData.resize(dataSize + patched.importCount * 0x10);
+			encodeImports(bundle.platform != 1, patched.imports.constData(),
+				patched.importCount, (uchar*)primaryData.data() + dataSize);
+		}
+		portions[0] = primaryData;
+	}
+	if (!files.secondary.isEmpty())
+		portions[secondaryMemType] = readInput(files.secondary.first());
+
+	// Sizes keep the alignment already set, and the data is compressed if the
+	// bundle is
+	bool replaced[3] = { replacePrimary || replaceImports, false, false };
+	if (!files.secondary.isEmpty())
+		replaced[secondaryMemType] = true;
+	for (int memType = 0; memType < 3; ++memType)
+	{
+		if (!replaced[memType])
+			continue;
+		if (portions[memType].isEmpty() || portions[memType].size() > 0x0FFFFFFF)
+		{
+			qCritical().noquote() << "Resource" << resourceKey << "memory type" << memType
+				<< "replacement is empty or too large. Aborting.";
+			return false;
+		}
+		patched.uncompressedInfo[memType] = (patched.uncompressedInfo[memType] & 0xF0000000) | portions[memType].size();
+		if (bundle.flags & (uint32_t)Bundle::Flags::IsCompressed)
+			portions[memType] = compressPortion(worker, patched.type, portions[memType]);
+	}
+	return true;
+}
+
+// The uncompressed data of a portion still in the bundle
+QByteArray YAP::readBundlePortion(GameDataStream& stream, Bundle& bundle, const ResourceEntry& entry, int memType)
+{
+	QIODevice* device = stream.device();
+	device->seek(bundle.resourceData[memType] + entry.offset[memType]);
+	QByteArray data = device->read(entry.compressedSize[memType]);
+	uint32_t uncompressedSize = entry.uncompressedInfo[memType] & 0x0FFFFFFF;
+	if (!(bundle.flags & (uint32_t)Bundle::Flags::IsCompressed))
+	{
+		if ((uint64_t)data.size() >= uncompressedSize)
+			return data.first(uncompressedSize);
+	}
+	else if (data.size() == entry.compressedSize[memType])
+	{
+		QByteArray resource(uncompressedSize, Qt::Uninitialized);
+		auto r = libdeflate_zlib_decompress(dc, data.constData(), data.size(), resource.data(), uncompressedSize, nullptr);
+		if (r == LIBDEFLATE_SUCCESS)
+			return resource;
+	}
+	qCritical().noquote().nospace()
+		<< "Resource 0x" << QString::number(entry.id, 16).toUpper().rightJustified(8, '0')
+		<< " memory type " << memType << " could not be read from the bundle. Aborting.";
+	return QByteArray();
+}
+
+// Writes a portion where its old data was if it fits before the next data in
+// the same memory type, or at the end of that memory type's data if not. Data
+// shared with other entries is never overwritten.
+void YAP::placePortion(GameDataStream& stream, Bundle& bundle, uint32_t index, int memType, const QByteArray& portion)
+{
+	QIODevice* device = stream.device();
+	ResourceEntry& entry = bundle.entries[index];
+	uint32_t oldOffset = entry.offset[memType];
+	uint32_t oldSize = entry.compressedSize[memType];
+	uint32_t size = portion.size();
+	auto capacity = [&]
+	{
+		return memType < 2 ? bundle.resourceData[memType + 1] - bundle.resourceData[memType] : UINT32_MAX;
+	};
+	uint32_t nextStart = capacity();
+	uint32_t dataEnd = 0;
+	bool shared = false;
+	for (uint32_t i = 0; i < bundle.resourceCount; ++i)
+	{
+		const ResourceEntry& other = bundle.entries[i];
+		if (i == index || other.compressedSize[memType] == 0)
+			continue;
+		dataEnd = std::max(dataEnd, other.offset[memType] + other.compressedSize[memType]);
+		if (oldSize != 0 && other.offset[memType] == oldOffset)
+			shared = true;
+		else if (other.offset[memType] > oldOffset)
+			nextStart = std::min(nextStart, other.offset[memType]);
+	}
+
+	// Clear the old data first, since moved data may start inside it
+	if (oldSize != 0 && !shared)
+	{
+		device->seek(bundle.resourceData[memType] + oldOffset);
+		device->write(QByteArray(oldSize, '\0'));
+	}
+	uint32_t offset = oldOffset;
+	if (oldSize == 0 || shared || (uint64_t)oldOffset + size > nextStart)
+	{
+		uint32_t alignment = memType == 0 ? 0x10 : 0x80;
+		offset = (dataEnd + alignment - 1) / alignment * alignment;
+		if ((uint64_t)offset + size > capacity())
+		{
+			uint32_t needed = offset + size - capacity();
+			shiftMemoryTypes(stream, bundle, memType + 1, (needed + 0x7F) & ~0x7F);
+		}
+	}
+	device->seek(bundle.resourceData[memType] + offset);
+	device->write(portion);
+	entry.offset[memType] = offset;
+	entry.compressedSize[memType] = size;
+}
+
+// Moves the data of every memory type from first on later in the file,
+// keeping their 0x80 byte alignment
+void YAP::shiftMemoryTypes(GameDataStream& stream, Bundle& bundle, int first, uint32_t distance)
+{
+	QIODevice* device = stream.device();
+	qint64 start = bundle.resourceData[first];
+	// Copied from the end backwards so nothing is overwritten before it's moved
+	const qint64 chunkSize = 0x1000000;
+	for (qint64 end = device->size(); end > start; )
+	{
+		qint64 chunk = std::min(chunkSize, end - start);
+		end -= chunk;
+		device->seek(end);
+		QByteArray data = device->read(chunk);
+		device->seek(end + distance);
+		device->write(data);
+	}
+	device->seek(start);
+	device->write(QByteArray(distance, '\0'));
+	for (int memType = first; memType < 3; ++memType)
+		bundle.resourceData[memType] += distance;
+	std::cout << "Moved memory type " << first << (first < 2 ? " and later" : "") << " data by 0x"
+		<< QString::number(distance, 16).toUpper().toStdString() << " bytes\n";
+}
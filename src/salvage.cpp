@@ -0,0 +1,190 @@
+#include <yap.h>
+#include <output-queue.h>
+#include <QByteArray>
+#include <QFile>
+#include <algorithm>
+#include <cstring>
+#include <bit>
+#include <iostream>
+#include <utility>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define YAP_SSE2
+#endif
+
+namespace
+{
+	// CMF 0x78 (deflate, 32K window), an FLG passing its check with no preset
+	// dictionary, and a valid first block type
+	inline bool isZlibHeader(const uchar* data)
+	{
+		return data[0] == 0x78 && (data[1] & 0x20) == 0
+			&& ((data[0] << 8) | data[1]) % 31 == 0
+			&& ((data[2] >> 1) & 3) != 3;
+	}
+
+	// Returns the offset of the next possible zlib stream in [from, end), or
+	// -1 if there are none
+	qint64 findZlibHeader(const uchar* data, qint64 from, qint64 end)
+	{
+		qint64 i = from;
+#ifdef YAP_SSE2
+		// Look for CMF 16 bytes at a time, only checking the rest on a match
+		const __m128i cmf = _mm_set1_epi8(0x78);
+		for (; i + 18 <= end; i += 16)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+			unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, cmf));
+			for (; mask != 0; mask &= mask - 1)
+			{
+				qint64 offset = i + std::countr_zero(mask);
+				if (isZlibHeader(data + offset))
+					return offset;
+			}
+		}
+#endif
+		for (; i + 3 <= end; ++i)
+		{
+			if (isZlibHeader(data + i))
+				return i;
+		}
+		return -1;
+	}
+}
+
+void YAP::salvageResources(QFile& file, Bundle& bundle, uint32_t validCount,
+	const QList<uint32_t>& untrusted, QList<uint32_t>& selection)
+{
+	if (!(bundle.flags & (uint32_t)Bundle::Flags::IsCompressed))
+	{
+		qWarning() << "Bundle is not compressed, so no further resources can be salvaged.";
+		return;
+	}
+
+	const uchar* data = mappedBundle;
+	qint64 size = mappedBundleSize;
+	QByteArray fileData;
+	if (data == nullptr)
+	{
+		file.seek(0);
+		fileData = file.readAll();
+		data = (const uchar*)fileData.constData();
+		size = fileData.size();
+	}
+
+	// Everything after the trusted entries may hold resource data, other than
+	// the data of the trusted resources
+	std::vector<std::pair<qint64, qint64>> skipped;
+	for (uint32_t i = 0; i < validCount; ++i)
+	{
+		const ResourceEntry& entry = bundle.entries[i];
+		for (int j = 0; j < 3; ++j)
+		{
+			qint64 start = (qint64)bundle.resourceData[j] + entry.offset[j];
+			if (entry.compressedSize[j] != 0)
+				skipped.emplace_back(start, start + entry.compressedSize[j]);
+		}
+	}
+	std::sort(skipped.begin(), skipped.end());
+	std::vector<std::pair<qint64, qint64>> regions;
+	qint64 regionStart = std::min<qint64>((qint64)bundle.resourceEntries + validCount * 0x40, size);
+	for (const auto& [start, end] : skipped)
+	{
+		if (start > regionStart)
+			regions.emplace_back(regionStart, std::min(start, size));
+		regionStart = std::max(regionStart, end);
+	}
+	if (regionStart < size)
+		regions.emplace_back(regionStart, size);
+
+	// Decompressed sizes of the untrusted entries' portions, to identify
+	// what's found. The entries may be partly intact even if they failed
+	// validation.
+	QHash<uint32_t, QList<std::pair<uint32_t, int>>> portionsBySize;
+	for (uint32_t index : untrusted)
+	{
+		const ResourceEntry& entry = bundle.entries[index];
+		if ((entry.id & 0xFFFFFFFF) == 0 || (entry.id & 0xFFFFFFFF00000000) != 0)
+			continue; // Can't be named
+		for (int j = 0; j < 3; ++j)
+		{
+			uint32_t uncompressedSize = entry.uncompressedInfo[j] & 0x0FFFFFFF;
+			if (entry.compressedSize[j] != 0 && uncompressedSize != 0 && selectedMemoryTypes[j])
+				portionsBySize[uncompressedSize].append({ index, j });
+		}
+	}
+
+	std::cout << "Scanning for resource data after entry " << validCount << '\n';
+	createDecompressor();
+	QHash<uint32_t, int> matchedPortions; // Entry index, memory types found
+	int foundCount = 0;
+	int matchedCount = 0;
+	QByteArray buffer(0x100000, Qt::Uninitialized);
+	for (const auto& [start, end] : regions)
+	{
+		for (qint64 offset = findZlibHeader(data, start, end); offset >= 0; offset = findZlibHeader(data, offset, end))
+		{
+			// The size is unknown, so grow the buffer until it fits
+			size_t actualIn = 0;
+			size_t actualOut = 0;
+			libdeflate_result r;
+			while ((r = libdeflate_zlib_decompress_ex(dc, data + offset, end - offset, buffer.data(),
+				buffer.size(), &actualIn, &actualOut)) == LIBDEFLATE_INSUFFICIENT_SPACE
+				&& buffer.size() < 0x10000000)
+				buffer.resize(buffer.size() * 2);
+			if (r != LIBDEFLATE_SUCCESS || actualOut == 0)
+			{
+				++offset;
+				continue;
+			}
+
+			// Only match sizes belonging to a single portion
+			QByteArray resource = output->takeBuffer();
+			resource.resize(actualOut);
+			memcpy(resource.data(), buffer.constData(), actualOut);
+			QString path;
+			QList<std::pair<uint32_t, int>>& portions = portionsBySize[actualOut];
+			if (portions.size() == 1)
+			{
+				auto [index, memType] = portions.takeFirst();
+				ResourceEntry& entry = bundle.entries[index];
+				if (memType == 0)
+					resource.truncate(readImports(bundle, entry, resource));
+				path = generateFilePath(entry, memType);
+				matchedPortions[index] |= 1 << memType;
+				++matchedCount;
+			}
+			else
+			{
+				path = outPath + "salvaged/" + QString::number(offset, 16).toUpper().rightJustified(8, '0') + defaultSuffix;
+			}
+			output->write(path, std::move(resource));
+			++foundCount;
+			offset += actualIn;
+			std::cout << "\rSalvaged " << foundCount << " streams" << std::flush;
+		}
+	}
+	std::cout << '\n';
+
+	// Resources with every portion found can be rebuilt
+	for (auto it = matchedPortions.cbegin(); it != matchedPortions.cend(); ++it)
+	{
+		ResourceEntry& entry = bundle.entries[it.key()];
+		int portions = 0;
+		for (int j = 0; j < 3; ++j)
+		{
+			if (entry.compressedSize[j] != 0 && selectedMemoryTypes[j])
+				portions |= 1 << j;
+		}
+		if (it.value() == portions)
+		{
+			selection.append(it.key());
+			if (!combineImports)
+				outputImports(bundle, it.key(), -1);
+		}
+	}
+	std::sort(selection.begin(), selection.end());
+
+	std::cout << "Salvaged " << foundCount << " streams, " << matchedCount
+		<< " matched to resource entries\n";
+}
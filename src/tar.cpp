@@ -0,0 +1,166 @@
+#include <tar.h>
+#include <QDebug>
+#include <cstring>
+
+namespace
+{
+	const int blockSize = 0x200;
+
+	struct Header
+	{
+		char name[100];
+		char mode[8];
+		char uid[8];
+		char gid[8];
+		char size[12];
+		char modifiedTime[12];
+		char checksum[8];
+		char type;
+		char linkName[100];
+		char magic[6];
+		char version[2];
+		char userName[32];
+		char groupName[32];
+		char deviceMajor[8];
+		char deviceMinor[8];
+		char prefix[155];
+		char padding[12];
+	};
+	static_assert(sizeof(Header) == blockSize);
+
+	void writeOctal(char* field, int length, uint64_t value)
+	{
+		QByteArray octal = QByteArray::number(value, 8).rightJustified(length - 1, '0');
+		std::memcpy(field, octal.constData(), length - 1);
+		field[length - 1] = '\0';
+	}
+
+	uint64_t readOctal(const char* field, int length)
+	{
+		uint64_t value = 0;
+		int i = 0;
+		while (i < length && field[i] == ' ')
+			++i;
+		for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i)
+			value = (value << 3) | (field[i] - '0');
+		return value;
+	}
+
+	uint32_t checksum(const Header& header)
+	{
+		// Checksum field itself is counted as spaces
+		Header copy = header;
+		std::memset(copy.checksum, ' ', sizeof(copy.checksum));
+		uint32_t sum = 0;
+		for (int i = 0; i < blockSize; ++i)
+			sum += ((const unsigned char*)&copy)[i];
+		return sum;
+	}
+
+	QString readName(const char* field, int length)
+	{
+		return QString::fromUtf8(field, strnlen(field, length));
+	}
+}
+
+TarWriter::TarWriter(QIODevice* device, qint64 modifiedTime)
+	: device(device), modifiedTime(modifiedTime)
+{
+}
+
+bool TarWriter::addFile(const QString& path, const QByteArray& data)
+{
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+
+	// Names over 100 bytes are split across the prefix and name fields at a '/'
+	QByteArray name = path.toUtf8();
+	if (name.size() > (int)sizeof(header.name))
+	{
+		int split = name.lastIndexOf('/', sizeof(header.prefix));
+		if (split <= 0 || name.size() - split - 1 > (int)sizeof(header.name))
+		{
+			qWarning() << "Path" << path << "is too long to be stored in a tar archive.";
+			return false;
+		}
+		std::memcpy(header.prefix, name.constData(), split);
+		name = name.sliced(split + 1);
+	}
+	std::memcpy(header.name, name.constData(), name.size());
+
+	writeOctal(header.mode, sizeof(header.mode), 0644);
+	writeOctal(header.uid, sizeof(header.uid), 0);
+	writeOctal(header.gid, sizeof(header.gid), 0);
+	writeOctal(header.size, sizeof(header.size), data.size());
+	writeOctal(header.modifiedTime, sizeof(header.modifiedTime), modifiedTime);
+	header.type = '0';
+	std::memcpy(header.magic, "ustar", 6);
+	std::memcpy(header.version, "00", 2);
+	writeOctal(header.checksum, 7, checksum(header));
+	header.checksum[7] = ' ';
+
+	if (device->write((const char*)&header, blockSize) != blockSize
+		|| device->write(data) != data.size())
+		return false;
+	int padding = (blockSize - data.size() % blockSize) % blockSize;
+	if (padding != 0)
+		device->write(QByteArray(padding, '\0'));
+	return true;
+}
+
+bool TarWriter::finish()
+{
+	// End of archive marker
+	return device->write(QByteArray(blockSize * 2, '\0')) == blockSize * 2;
+}
+
+bool TarReader::read(const QByteArray& archive, const QString& prefix, QHash<QString, QByteArray>& files)
+{
+	QString longName; // GNU long name for the next file, if any
+	qsizetype pos = 0;
+	while (pos + blockSize <= archive.size())
+	{
+		const Header& header = *(const Header*)(archive.constData() + pos);
+		if (header.name[0] == '\0') // End of archive
+			return true;
+		if (readOctal(header.checksum, sizeof(header.checksum)) != checksum(header))
+		{
+			qCritical().nospace() << "Invalid tar header at offset 0x" << QString::number(pos, 16) << ".";
+			return false;
+		}
+
+		uint64_t size = readOctal(header.size, sizeof(header.size));
+		qsizetype dataStart = pos + blockSize;
+		if (dataStart + (qint64)size > archive.size())
+		{
+			qCritical() << "Tar archive is truncated.";
+			return false;
+		}
+		QByteArray data = QByteArray::fromRawData(archive.constData() + dataStart, size);
+		pos = dataStart + (size + blockSize - 1) / blockSize * blockSize;
+
+		if (header.type == 'L')
+		{
+			longName = readName(data.constData(), data.size());
+			continue;
+		}
+		if (header.type != '0' && header.type != '\0') // Not a regular file
+		{
+			longName.clear();
+			continue;
+		}
+
+		QString name = longName;
+		longName.clear();
+		if (name.isEmpty())
+		{
+			name = readName(header.name, sizeof(header.name));
+			if (header.prefix[0] != '\0')
+				name.prepend(readName(header.prefix, sizeof(header.prefix)) + '/');
+		}
+		if (name.startsWith("./"))
+			name = name.sliced(2);
+		files.insert(prefix + name, data);
+	}
+	return true;
+}
@@ -0,0 +1,269 @@
+#include <yap.h>
+#include <import-codec.h>
+#include <QByteArray>
+#include <QFile>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+int YAP::verify()
+{
+	QFile inFile(inPath);
+	GameDataStream inStream(&inFile);
+	inFile.open(QIODeviceBase::ReadOnly);
+	if (!validateBundle(inStream))
+		return 2;
+	setShaderTypeName(inStream);
+	Bundle bundle;
+	readBundle(inStream, bundle);
+	if (!validateResourceEntries(bundle))
+		return 3;
+	QList<uint32_t> selection;
+	if (!selectResources(bundle, selection))
+		return 4;
+	mappedBundleSize = inFile.size();
+	mappedBundle = inFile.map(0, mappedBundleSize);
+
+	// Same scheme as extraction, but every worker only needs a scratch buffer
+	// large enough for the largest portion since nothing is kept
+	std::atomic<uint32_t> nextIndex = 0;
+	std::atomic<uint32_t> verifiedCount = 0;
+	std::mutex statsMutex;
+	QMap<uint32_t, VerifyStats> stats;
+	uint32_t selectedCount = selection.size();
+	uint32_t maxSize = 0;
+	for (uint32_t index : selection)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			maxSize = std::max(maxSize, bundle.entries[index].compressedSize[i]);
+			maxSize = std::max(maxSize, bundle.entries[index].uncompressedInfo[i] & 0x0FFFFFFF);
+		}
+	}
+
+	auto work = [&](ExtractWorker& worker)
+	{
+		QByteArray scratch(maxSize + 1, Qt::Uninitialized);
+		QMap<uint32_t, VerifyStats> workerStats;
+		for (uint32_t i = nextIndex++; i < selectedCount; i = nextIndex++)
+		{
+			const ResourceEntry& entry = bundle.entries[selection[i]];
+			VerifyStats& typeStats = workerStats[entry.type];
+			++typeStats.count;
+			if (!verifyResource(worker, bundle, entry, scratch, typeStats))
+				++typeStats.failures;
+			uint32_t verified = ++verifiedCount;
+			std::lock_guard<std::mutex> lock(statsMutex);
+			std::cout << "\rVerified resource " << verified << "/" << selectedCount << std::flush;
+		}
+
+		std::lock_guard<std::mutex> lock(statsMutex);
+		for (auto it = workerStats.cbegin(); it != workerStats.cend(); ++it)
+		{
+			VerifyStats& typeStats = stats[it.key()];
+			typeStats.count += it.value().count;
+			typeStats.failures += it.value().failures;
+			typeStats.compressedSize += it.value().compressedSize;
+			typeStats.uncompressedSize += it.value().uncompressedSize;
+		}
+	};
+
+	createDecompressor();
+	std::vector<std::thread> workers;
+	uint32_t workerCount = std::min(jobs, selectedCount);
+	for (uint32_t i = 1; i < workerCount; ++i)
+	{
+		workers.emplace_back([&]
+		{
+			QFile file(inPath);
+			GameDataStream workerStream(&file);
+			workerStream.setPlatform(inStream.platform());
+			if (mappedBundle == nullptr)
+				file.open(QIODeviceBase::ReadOnly);
+			ExtractWorker worker;
+			worker.stream = &workerStream;
+			worker.decompressor = libdeflate_alloc_decompressor();
+			work(worker);
+			libdeflate_free_decompressor(worker.decompressor);
+			file.close();
+		});
+	}
+	ExtractWorker mainWorker;
+	mainWorker.stream = &inStream;
+	mainWorker.decompressor = dc;
+	work(mainWorker);
+	for (std::thread& worker : workers)
+		worker.join();
+	std::cout << "\n\n";
+
+	if (mappedBundle != nullptr)
+		inFile.unmap(mappedBundle);
+	mappedBundle = nullptr;
+	inFile.close();
+
+	VerifyStats total;
+	std::cout << QString("Type").leftJustified(32).toStdString() << "Count     Failures  "
+		<< QString("Compressed").leftJustified(14).toStdString()
+		<< QString("Uncompressed").leftJustified(14).toStdString() << "Ratio\n";
+	auto printStats = [](const QString& name, const VerifyStats& typeStats)
+	{
+		double ratio = typeStats.uncompressedSize == 0 ? 0 : (double)typeStats.compressedSize / typeStats.uncompressedSize;
+		std::cout << name.leftJustified(32).toStdString()
+			<< QString::number(typeStats.count).leftJustified(10).toStdString()
+			<< QString::number(typeStats.failures).leftJustified(10).toStdString()
+			<< QString::number(typeStats.compressedSize).leftJustified(14).toStdString()
+			<< QString::number(typeStats.uncompressedSize).leftJustified(14).toStdString()
+			<< QString::number(ratio, 'f', 4).toStdString() << '\n';
+	};
+	for (auto it = stats.cbegin(); it != stats.cend(); ++it)
+	{
+		QString type = "0x" + QString::number(it.key(), 16);
+		if (resourceTypes.contains(it.key()))
+			type = resourceTypes.value(it.key()) + " (" + type + ")";
+		printStats(type, it.value());
+		total.count += it.value().count;
+		total.failures += it.value().failures;
+		total.compressedSize += it.value().compressedSize;
+		total.uncompressedSize += it.value().uncompressedSize;
+	}
+	printStats("Total", total);
+
+	if (total.failures != 0)
+	{
+		std::cout << "\nVerification failed for " << total.failures << " resources";
+		return 5;
+	}
+	std::cout << "\nAll resources verified successfully";
+	return 0;
+}
+
+bool YAP::verifyResource(ExtractWorker& worker, Bundle& bundle, const ResourceEntry& entry,
+	QByteArray& scratch, VerifyStats& stats)
+{
+	QString id = QString::number(entry.id, 16).toUpper().rightJustified(8, '0');
+	bool isCompressed = bundle.flags & (uint32_t)Bundle::Flags::IsCompressed;
+	bool verified = true;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (entry.compressedSize[i] == 0 || !selectedMemoryTypes[i])
+			continue;
+		uint32_t uncompressedSize = entry.uncompressedInfo[i] & 0x0FFFFFFF;
+		stats.compressedSize += entry.compressedSize[i];
+		stats.uncompressedSize += uncompressedSize;
+
+		qint64 dataOffset = (qint64)entry.offset[i] + bundle.resourceData[i];
+		const char* data = nullptr;
+		if (mappedBundle != nullptr)
+		{
+			if (dataOffset + entry.compressedSize[i] > mappedBundleSize)
+			{
+				qWarning().noquote().nospace() << "Resource 0x" << id << " memory type " << i
+					<< " extends past the end of the bundle.";
+				verified = false;
+				continue;
+			}
+			data = (const char*)mappedBundle + dataOffset;
+		}
+		else
+		{
+			worker.readBuffer[i].resize(entry.compressedSize[i]);
+			worker.stream->seek(dataOffset);
+			if (worker.stream->device()->read(worker.readBuffer[i].data(), entry.compressedSize[i]) != (qint64)entry.compressedSize[i])
+			{
+				qWarning().noquote().nospace() << "Resource 0x" << id << " memory type " << i
+					<< " extends past the end of the bundle.";
+				verified = false;
+				continue;
+			}
+			data = worker.readBuffer[i].constData();
+		}
+
+		const uchar* resource = (const uchar*)data;
+		if (isCompressed)
+		{
+			// Decompress into a buffer one byte larger than expected so
+			// oversized data is told apart from corrupt data
+			size_t actualSize = 0;
+			size_t bufferSize = std::min<size_t>(uncompressedSize + 1, scratch.size());
+			auto r = libdeflate_zlib_decompress(worker.decompressor, data, entry.compressedSize[i],
+				scratch.data(), bufferSize, &actualSize);
+			if (r == LIBDEFLATE_INSUFFICIENT_SPACE || (r == LIBDEFLATE_SUCCESS && actualSize > uncompressedSize))
+			{
+				qWarning().noquote().nospace() << "Resource 0x" << id << " memory type " << i
+					<< " decompresses to more than its expected size 0x" << QString::number(uncompressedSize, 16).toUpper() << ".";
+				verified = false;
+				continue;
+			}
+			if (r != LIBDEFLATE_SUCCESS)
+			{
+				qWarning().noquote().nospace() << "Resource 0x" << id << " memory type " << i
+					<< " failed to decompress.";
+				verified = false;
+				continue;
+			}
+			if (actualSize != uncompressedSize)
+			{
+				qWarning().noquote().nospace() << "Resource 0x" << id << " memory type " << i
+					<< " decompressed to 0x" << QString::number(actualSize, 16).toUpper()
+					<< " bytes, expected 0x" << QString::number(uncompressedSize, 16).toUpper() << ".";
+				verified = false;
+				continue;
+			}
+			resource = (const uchar*)scratch.constData();
+		}
+		else if (uncompressedSize > entry.compressedSize[i])
+		{
+			qWarning().noquote().nospace() << "Resource 0x" << id << " memory type " << i
+				<< " is larger than its data on disk.";
+			verified = false;
+			continue;
+		}
+
+		if (i == 0 && entry.importCount > 0 && !verifyImports(bundle, entry, resource, uncompressedSize))
+			verified = false;
+	}
+	return verified;
+}
+
+bool YAP::verifyImports(Bundle& bundle, const ResourceEntry& entry, const uchar* resource, uint32_t size)
+{
+	QString id = QString::number(entry.id, 16).toUpper().rightJustified(8, '0');
+	uint32_t importsSize = entry.importCount * 0x10;
+	if (importsSize > size)
+	{
+		qWarning().noquote().nospace() << "Resource 0x" << id << " imports are larger than the resource.";
+		return false;
+	}
+	uint32_t dataSize = size - importsSize;
+	if (entry.importsOffset != dataSize)
+	{
+		qWarning().noquote().nospace() << "Resource 0x" << id << " imports offset 0x"
+			<< QString::number(entry.importsOffset, 16).toUpper() << " does not match the imports at 0x"
+			<< QString::number(dataSize, 16).toUpper() << ".";
+		return false;
+	}
+
+	// Imports point to other resources and are written into this one
+	QList<ImportEntry> imports(entry.importCount);
+	decodeImports(bundle.platform != 1, resource + dataSize, imports.data(), entry.importCount);
+	for (int j = 0; j < entry.importCount; ++j)
+	{
+		uint64_t importId = imports[j].id;
+		uint32_t offset = imports[j].offset;
+		if ((importId & 0xFFFFFFFF) == 0 || (importId & 0xFFFFFFFF00000000) != 0)
+		{
+			qWarning().noquote().nospace() << "Resource 0x" << id << " import " << j
+				<< " has invalid ID 0x" << QString::number(importId, 16).toUpper() << ".";
+			return false;
+		}
+		if (dataSize < 4 || offset > dataSize - 4 || offset % 4 != 0) // Written this way so it can't overflow
+		{
+			qWarning().noquote().nospace() << "Resource 0x" << id << " import " << j
+				<< " has invalid offset 0x" << QString::number(offset, 16).toUpper() << ".";
+			return false;
+		}
+	}
+	return true;
+}
@@ -2,6 +2,12 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QFileInfo>
+#include <QThread>
+#include <tar.h>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
 
 YAP::YAP(int argc, char* argv[])
 {
@@ -16,13 +22,21 @@ YAP::YAP(int argc, char* argv[])
 		result = extract();
 	else if (mode == "c")
 		result = create();
+	else if (mode == "l")
+		result = list();
+	else if (mode == "v")
+		result = verify();
+	else if (mode == "b")
+		result = batch();
+	else if (mode == "p")
+		result = patch();
 }
 
 YAP::~YAP()
 {
-	if (dc != nullptr)
+	if (dc != nullptr && !sharedCodecs)
 		libdeflate_free_decompressor(dc);
-	if (cmp != nullptr)
+	if (cmp != nullptr && !sharedCodecs)
 		libdeflate_free_compressor(cmp);
 	delete args;
 }
@@ -31,12 +45,14 @@ void YAP::setupArgs()
 {
 	args = new argparse::ArgumentParser("YAP", version, argparse::default_arguments::help);
 	args->add_argument("mode")
-		.choices("e", "c")
-		.help("e=Extract the contents of a bundle to a folder\nc=Create a new bundle from a folder");
+		.choices("e", "c", "l", "v", "b", "p")
+		.help("e=Extract the contents of a bundle to a folder\nc=Create a new bundle from a folder\nl=List the resources in a bundle or a folder of bundles\nv=Verify that every resource in a bundle decompresses cleanly\nb=Run a batch of extract and create jobs\np=Replace resources in an existing bundle with files from a folder");
 	args->add_argument("input")
-		.help("If extracting, the bundle to extract\nIf creating, the folder to generate a bundle from");
+		.help("If extracting, listing, or verifying, the bundle to use\nIf creating, the folder to generate a bundle from\nIf batching, a YAML manifest of jobs or a folder of bundles to extract\nIf patching, the folder of replacement resource files");
 	args->add_argument("output")
-		.help("If extracting, the folder to output to\nIf creating, the file to output");
+		.nargs(argparse::nargs_pattern::optional)
+		.default_value(std::string(""))
+		.help("If extracting, the folder to output to\nIf creating, the file to output\nIf listing, the file to output (optional, default stdout)\nIf batching a folder, the folder to extract bundles to\nIf patching, the bundle to modify in place");
 	args->add_argument("-ns", "--nosort")
 		.store_into(doNotSortByType)
 		.flag()
@@ -45,12 +61,52 @@ void YAP::setupArgs()
 		.store_into(combineImports)
 		.flag()
 		.help("(Extract only) Consolidate the imports for every resource into a single file.");
+	args->add_argument("-T", "--tar")
+		.flag()
+		.help("(Extract only) Write a tar archive to the output path instead of a folder.\nUse - to write to stdout. When creating, a tar archive (or - for stdin) is\ndetected automatically.");
+	args->add_argument("-u", "--incremental")
+		.store_into(incremental)
+		.flag()
+		.help("(Extract only) Only write resources that changed since the last extraction to\nthe output folder, and remove files that are no longer needed. Can't be used\nwith the filters.");
+	args->add_argument("-S", "--salvage")
+		.store_into(salvage)
+		.flag()
+		.help("(Extract only) If the resource entries of a corrupt bundle fail validation,\nextract those before the first invalid entry, then scan the rest of the bundle\nfor resource data.");
+	args->add_argument("-i", "--id")
+		.append()
+		.help("(Extract and verify only) Only use the resource with this ID. May be repeated\nor comma-separated.");
+	args->add_argument("-t", "--type")
+		.append()
+		.help("(Extract and verify only) Only use resources of this type, given as a number\nor name. May be repeated or comma-separated.");
+	args->add_argument("-m", "--memory-type")
+		.append()
+		.help("(Extract and verify only) Only use data in this memory type (0, 1, or 2). May\nbe repeated or comma-separated.");
+	args->add_argument("-j", "--jobs")
+		.help("The number of resources to extract, verify, or compress, or batch jobs to run,\nin parallel.\nDefault: The number of hardware threads");
+	args->add_argument("-f", "--format")
+		.choices("text", "json", "csv")
+		.help("(List only) The format to list resources in.\nDefault: text");
+	args->add_argument("-p", "--profile")
+		.choices("fast", "default", "ship")
+		.help("(Create and patch only) The compression profile to use.\nfast=Compression level 1, for quick iteration\ndefault=Compression level 9\nship=Try levels 9-12 on every resource and keep the smallest\nDefault: default");
+	args->add_argument("-tl", "--type-level")
+		.append()
+		.help("(Create and patch only) Compress resources of a type at this level (0-12) instead of the\nprofile's, as TYPE=LEVEL with the type as a number or name. May be repeated.");
+	args->add_argument("-C", "--cache")
+		.help("(Create and patch only) A folder to cache compressed resources in. Resources that were\ncompressed with the same settings before are copied from it instead.");
+	args->add_argument("-d", "--dedup")
+		.choices("copy", "share")
+		.help("(Create only) Compress resource portions with identical data once.\ncopy=Write each copy of the compressed data\nshare=Point every copy's entry at the same data. Needs a game that accepts this.");
+	args->add_argument("-e", "--estimate")
+		.store_into(estimate)
+		.flag()
+		.help("(Create only) Compress a sample of the resources and estimate the size of the\nbundle and the time taken to create it, without writing anything.");
 	args->add_argument("-ap", "--primary-alignment")
 		.help("(Create only) The alignment to be set on a resource's primary portion if no\nvalue is specified.\nMust be a power of 2 <=0x8000\nDefault: 0x10");
 	args->add_argument("-as", "--secondary-alignment")
 		.help("(Create only) The alignment to be set on a resource's secondary portion if no\nvalue is specified.\nMust be a power of 2 <=0x8000\nDefault: 0x80");
 	args->add_description("A simple bundle extractor/creator.\nVersion " + version + ", built " + date);
-	args->add_epilog("Examples:\n  YAP e AI.DAT ai_extracted\n  YAP c ai_extracted AI.DAT");
+	args->add_epilog("Examples:\n  YAP e AI.DAT ai_extracted\n  YAP c ai_extracted AI.DAT\n  YAP l AI.DAT --format csv\n  YAP v AI.DAT\n  YAP b jobs.yaml\n  YAP p ai_patch AI.DAT");
 }
 
 bool YAP::readArgs(int argc, char* argv[])
@@ -77,17 +133,109 @@ bool YAP::readArgs(int argc, char* argv[])
 
 	inPath = args->get("input").c_str();
 	outPath = args->get("output").c_str();
-	inPath = QDir::cleanPath(inPath);
-	outPath = QDir::cleanPath(outPath);
-	if (mode == "e")
+	if (outPath.isEmpty() && mode != "l" && mode != "v" && !(mode == "b" && QFileInfo(inPath).isFile()))
 	{
-		if (!outPath.endsWith('/'))
-			outPath += '/';
+		qCritical().noquote().nospace() << "An output path is required for this mode.\n\n" << args->help().str();
+		return false;
 	}
-	else if (mode == "c")
+	preparePaths(mode == "e" && args->get<bool>("--tar"));
+
+	if (args->is_used("--format"))
+		listFormat = args->get("--format").c_str();
+
+	if (args->is_used("--id"))
 	{
-		if (!inPath.endsWith('/'))
-			inPath += '/';
+		for (const std::string& arg : args->get<std::vector<std::string>>("--id"))
+		{
+			for (const QString& idString : QString::fromStdString(arg).split(',', Qt::SkipEmptyParts))
+			{
+				uint64_t id = 0;
+				if (!validateResourceIdKey(idString.trimmed().toStdString(), id))
+					return false;
+				selectedIds.insert(id);
+			}
+		}
+	}
+	if (args->is_used("--type"))
+	{
+		for (const std::string& arg : args->get<std::vector<std::string>>("--type"))
+		{
+			for (const QString& typeString : QString::fromStdString(arg).split(',', Qt::SkipEmptyParts))
+			{
+				if (typeString.trimmed().isEmpty())
+				{
+					qCritical().noquote().nospace() << "Invalid value " << QString::fromStdString(arg) << ". Aborting.";
+					return false;
+				}
+				selectedTypeStrings.append(typeString.trimmed());
+			}
+		}
+	}
+	if (args->is_used("--memory-type"))
+	{
+		for (int i = 0; i < 3; ++i)
+			selectedMemoryTypes[i] = false;
+		for (const std::string& arg : args->get<std::vector<std::string>>("--memory-type"))
+		{
+			for (const QString& memTypeString : QString::fromStdString(arg).split(',', Qt::SkipEmptyParts))
+			{
+				uint32_t memType = 0;
+				if (!stringToUInt<uint32_t>(memTypeString.trimmed(), memType, true))
+					return false;
+				if (memType > 2)
+				{
+					qCritical() << "Invalid memory type: Must be 0, 1, or 2.";
+					return false;
+				}
+				selectedMemoryTypes[memType] = true;
+			}
+		}
+	}
+
+	if (args->is_used("--jobs"))
+	{
+		if (!stringToUInt<uint32_t>(args->get("--jobs").c_str(), jobs, false, 0))
+			return false;
+	}
+
+	if (args->is_used("--profile"))
+	{
+		compressionProfile = args->get("--profile").c_str();
+		if (compressionProfile == "fast")
+			compressionLevel = 1;
+	}
+	if (args->is_used("--dedup"))
+		dedupMode = args->get("--dedup").c_str();
+	if (args->is_used("--cache"))
+	{
+		cachePath = QDir::cleanPath(args->get("--cache").c_str());
+		if (!cachePath.endsWith('/'))
+			cachePath += '/';
+	}
+	if (args->is_used("--type-level"))
+	{
+		for (const std::string& arg : args->get<std::vector<std::string>>("--type-level"))
+		{
+			QString typeLevel = QString::fromStdString(arg);
+			qsizetype separator = typeLevel.lastIndexOf('=');
+			uint32_t level = 0;
+			if (separator <= 0 || !stringToUInt<uint32_t>(typeLevel.sliced(separator + 1).trimmed(), level, true))
+			{
+				qCritical().noquote() << "Invalid type level" << typeLevel << "- expected TYPE=LEVEL.";
+				return false;
+			}
+			if (level > 12)
+			{
+				qCritical() << "Invalid compression level: Must be 0-12.";
+				return false;
+			}
+			if (typeLevel.first(separator).trimmed().isEmpty())
+			{
+				qCritical().noquote().nospace() << "Invalid value " << typeLevel << ". Aborting.";
+				return false;
+			}
+			typeLevelStrings.insert(typeLevel.first(separator).trimmed(), level);
+		}
 	}
 
 	if (args->is_used("--primary-alignment"))
@@ -104,12 +252,49 @@ bool YAP::readArgs(int argc, char* argv[])
 	return true;
 }
 
+void YAP::preparePaths(bool tar)
+{
+	inPath = QDir::cleanPath(inPath);
+	if (!outPath.isEmpty())
+		outPath = QDir::cleanPath(outPath);
+	if (mode == "e" && tar)
+	{
+		// Files are named relative to the root of the archive
+		archivePath = outPath;
+		outPath = "";
+	}
+	else if (mode == "e" || (mode == "b" && !outPath.isEmpty()))
+	{
+		if (!outPath.endsWith('/'))
+			outPath += '/';
+	}
+	else if (mode == "p")
+	{
+		if (!inPath.endsWith('/'))
+			inPath += '/';
+	}
+	else if (mode == "c")
+	{
+		inputIsArchive = inPath == "-" || QFileInfo(inPath).isFile();
+		if (!inPath.endsWith('/'))
+			inPath += '/';
+	}
+}
+
 bool YAP::validateArgs()
 {
 	if (mode == "e" && !validateExtractArgs())
 		return false;
 	else if (mode == "c" && !validateCreateArgs())
 		return false;
+	else if (mode == "l" && !validateListArgs())
+		return false;
+	else if (mode == "v" && !validateVerifyArgs())
+		return false;
+	else if (mode == "b" && !validateBatchArgs())
+		return false;
+	else if (mode == "p" && !validatePatchArgs())
+		return false;
 	return true;
 }
 
@@ -123,6 +308,46 @@ bool YAP::validateExtractArgs()
 		return false;
 	}
 
+	if (jobs == 0)
+		jobs = std::max(QThread::idealThreadCount(), 1);
+
+	if (salvage && incremental)
+	{
+		qCritical() << "Incremental extraction is not supported when salvaging.";
+		return false;
+	}
+	// Files of resources left out would look stale, and the index and metadata
+	// must describe the whole folder
+	bool filtered = !selectedIds.isEmpty() || !selectedTypeStrings.isEmpty()
+		|| !selectedMemoryTypes[0] || !selectedMemoryTypes[1] || !selectedMemoryTypes[2];
+	if (filtered && incremental)
+	{
+		qCritical() << "Incremental extraction is not supported with --id, --type, or --memory-type.";
+		return false;
+	}
+
+	if (!archivePath.isEmpty())
+	{
+		if (incremental)
+		{
+			qCritical() << "Incremental extraction is not supported with tar output.";
+			return false;
+		}
+		if (archivePath == "-")
+		{
+			// Keep progress messages out of the archive
+			std::cout.rdbuf(std::cerr.rdbuf());
+		}
+		else if (!QFile(archivePath).open(QIODeviceBase::WriteOnly))
+		{
+			qCritical() << "Output archive cannot be opened."
+				<< "Ensure the path is correct and, if the file exists,"
+				<< "that it has the correct permissions set.";
+			return false;
+		}
+		return true;
+	}
+
 	QFileInfo outInfo(outPath);
 	if (!outInfo.exists())
 	{
@@ -155,12 +380,20 @@ bool YAP::validateExtractArgs()
 
 bool YAP::validateCreateArgs()
 {
-	QFileInfo inInfo(inPath);
-	if (!inInfo.exists() || !inInfo.isDir() || !inInfo.isReadable())
+	if (inputIsArchive)
 	{
-		qCritical() << "Input folder cannot be opened."
-			<< "Ensure is exists and has the correct permissions set.";
-		return false;
+		if (!readInputArchive())
+			return false;
+	}
+	else
+	{
+		QFileInfo inInfo(inPath);
+		if (!inInfo.exists() || !inInfo.isDir() || !inInfo.isReadable())
+		{
+			qCritical() << "Input folder cannot be opened."
+				<< "Ensure is exists and has the correct permissions set.";
+			return false;
+		}
 	}
 
 	QFileInfo outInfo(outPath);
@@ -170,7 +403,7 @@ bool YAP::validateCreateArgs()
 			<< "Rename the object or choose a different output location.";
 		return false;
 	}
-	if (!QFile(outInfo.absoluteFilePath()).open(QIODeviceBase::WriteOnly))
+	if (!estimate && !QFile(outInfo.absoluteFilePath()).open(QIODeviceBase::WriteOnly))
 	{
 		qCritical() << "Output file cannot be opened."
 			<< "Ensure the path is correct and, if the file exists,"
@@ -178,6 +411,15 @@ bool YAP::validateCreateArgs()
 		return false;
 	}
 
+	if (jobs == 0)
+		jobs = std::max(QThread::idealThreadCount(), 1);
+
+	if (!cachePath.isEmpty() && !QDir().mkpath(cachePath))
+	{
+		qCritical() << "Cache folder cannot be created. Check that the path is correct.";
+		return false;
+	}
+
 	// Ensure the alignments are powers of 2 and within bounds of 1 << 0 and 1 << 0xF
 	if (defaultPrimaryAlignment < 1 || defaultPrimaryAlignment > 0x8000
 		|| !std::has_single_bit(defaultPrimaryAlignment))
@@ -192,16 +434,282 @@ bool YAP::validateCreateArgs()
 		defaultSecondaryAlignment = 0x80;
 	}
 
-	if (!validateMetadata())
+	if (readCreateIndex())
+		std::cout << "Input unchanged since extraction, using index instead of metadata\n";
+	else if (!validateMetadata())
+		return false;
+
+	return true;
+}
+
+bool YAP::validateListArgs()
+{
+	QFileInfo inInfo(inPath);
+	if (!inInfo.exists() || !inInfo.isReadable())
+	{
+		qCritical() << "Input cannot be opened."
+			<< "Ensure it exists and has the correct permissions set.";
+		return false;
+	}
+
+	if (!outPath.isEmpty() && !QFile(outPath).open(QIODeviceBase::WriteOnly))
+	{
+		qCritical() << "Output file cannot be opened."
+			<< "Ensure the path is correct and, if the file exists,"
+			<< "that it has the correct permissions set.";
+		return false;
+	}
+
+	return true;
+}
+
+bool YAP::validateVerifyArgs()
+{
+	QFileInfo inInfo(inPath);
+	if (!inInfo.exists() || !inInfo.isFile() || !inInfo.isReadable())
+	{
+		qCritical() << "Input file cannot be opened."
+			<< "Ensure it exists and has the correct permissions set.";
+		return false;
+	}
+
+	if (jobs == 0)
+		jobs = std::max(QThread::idealThreadCount(), 1);
+
+	return true;
+}
+
+bool YAP::validatePatchArgs()
+{
+	QFileInfo inInfo(inPath);
+	if (!inInfo.exists() || !inInfo.isDir() || !inInfo.isReadable())
+	{
+		qCritical() << "Patch folder cannot be opened."
+			<< "Ensure it exists and has the correct permissions set.";
+		return false;
+	}
+	QFileInfo outInfo(outPath);
+	if (!outInfo.exists() || !outInfo.isFile() || !outInfo.isReadable() || !outInfo.isWritable())
+	{
+		qCritical() << "Bundle to patch cannot be opened."
+			<< "Ensure it exists and has the correct permissions set.";
+		return false;
+	}
+
+	if (jobs == 0)
+		jobs = std::max(QThread::idealThreadCount(), 1);
+
+	if (!cachePath.isEmpty() && !QDir().mkpath(cachePath))
+	{
+		qCritical() << "Cache folder cannot be created. Check that the path is correct.";
 		return false;
+	}
 
 	return true;
 }
 
+bool YAP::validateBatchArgs()
+{
+	QFileInfo inInfo(inPath);
+	if (!inInfo.exists() || !inInfo.isReadable())
+	{
+		qCritical() << "Batch input cannot be opened."
+			<< "Ensure it exists and has the correct permissions set.";
+		return false;
+	}
+	if (args->get<bool>("--tar"))
+	{
+		qCritical() << "Tar output is not supported in batch mode.";
+		return false;
+	}
+
+	if (jobs == 0)
+		jobs = std::max(QThread::idealThreadCount(), 1);
+
+	return true;
+}
+
+bool YAP::readInputArchive()
+{
+	QFile archiveFile;
+	bool opened = false;
+	if (inPath == "-/")
+		opened = archiveFile.open(stdin, QIODeviceBase::ReadOnly);
+	else
+	{
+		archiveFile.setFileName(inPath.chopped(1));
+		opened = archiveFile.open(QIODeviceBase::ReadOnly);
+	}
+	if (!opened)
+	{
+		qCritical() << "Input archive cannot be opened."
+			<< "Ensure it exists and has the correct permissions set.";
+		return false;
+	}
+	inputArchive = archiveFile.readAll();
+	archiveFile.close();
+	if (!TarReader::read(inputArchive, inPath, archiveFiles))
+		return false;
+	std::cout << "Read " << archiveFiles.size() << " files from input archive\n";
+	return true;
+}
+
+bool YAP::inputExists(const QString& path)
+{
+	if (inputIsArchive)
+		return archiveFiles.contains(path);
+	return QFileInfo(path).exists();
+}
+
+bool YAP::inputReadable(const QString& path)
+{
+	if (inputIsArchive)
+		return archiveFiles.contains(path);
+	QFileInfo info(path);
+	return info.exists() && info.isFile() && info.isReadable();
+}
+
+qint64 YAP::inputSize(const QString& path)
+{
+	if (inputIsArchive)
+		return archiveFiles.value(path).size();
+	qint64 size = inputSizes.value(path, -1);
+	if (size != -1)
+		return size;
+	return QFileInfo(path).size();
+}
+
+QByteArray YAP::readInput(const QString& path)
+{
+	if (inputIsArchive)
+		return archiveFiles.value(path);
+	QFile file(path);
+	file.open(QIODeviceBase::ReadOnly);
+	return file.readAll();
+}
+
+YAML::Node YAP::loadInputYaml(const QString& path)
+{
+	if (inputIsArchive)
+	{
+		QByteArray data = archiveFiles.value(path);
+		return YAML::Load(std::string(data.constData(), data.size()));
+	}
+	return YAML::LoadFile(path.toStdString());
+}
+
+// Walks the input once and indexes every data and imports file by resource
+// ID, so each resource's files can be looked up without searching again.
+// Subfolders are walked in parallel, then merged in a fixed order so
+// duplicates are always reported the same way.
+void YAP::indexInputFiles()
+{
+	inputFiles.clear();
+	inputSizes.clear();
+	if (inputIsArchive)
+	{
+		for (auto it = archiveFiles.cbegin(); it != archiveFiles.cend(); ++it)
+			addInputFile(inputFiles, it.key());
+		return;
+	}
+
+	QDir root(inPath);
+	for (const QFileInfo& info : root.entryInfoList(QDir::Files))
+	{
+		if (addInputFile(inputFiles, info.absoluteFilePath()))
+			inputSizes.insert(info.absoluteFilePath(), info.size());
+	}
+	QList<QFileInfo> folders = root.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot);
+	QList<QHash<uint64_t, InputFiles>> folderFiles(folders.size());
+	QList<QHash<QString, qint64>> folderSizes(folders.size());
+	std::atomic<qsizetype> nextFolder = 0;
+	auto run = [&]
+	{
+		for (qsizetype i = nextFolder++; i < folders.size(); i = nextFolder++)
+		{
+			QDirIterator it(folders[i].absoluteFilePath(), QDir::Files, QDirIterator::Subdirectories);
+			while (it.hasNext())
+			{
+				// The walk already has each size, so keep them to save a stat later
+				QFileInfo info = it.nextFileInfo();
+				if (addInputFile(folderFiles[i], info.absoluteFilePath()))
+					folderSizes[i].insert(info.absoluteFilePath(), info.size());
+			}
+		}
+	};
+	std::vector<std::thread> workers;
+	uint32_t workerCount = std::min<qsizetype>(jobs, folders.size());
+	for (uint32_t i = 1; i < workerCount; ++i)
+		workers.emplace_back(run);
+	run();
+	for (std::thread& worker : workers)
+		worker.join();
+
+	for (qsizetype i = 0; i < folders.size(); ++i)
+	{
+		for (auto it = folderFiles[i].cbegin(); it != folderFiles[i].cend(); ++it)
+		{
+			InputFiles& merged = inputFiles[it.key()];
+			merged.primary.append(it.value().primary);
+			merged.secondary.append(it.value().secondary);
+			merged.imports.append(it.value().imports);
+		}
+		for (auto it = folderSizes[i].cbegin(); it != folderSizes[i].cend(); ++it)
+			inputSizes.insert(it.key(), it.value());
+	}
+}
+
+// Adds the file to the index if it's named like a resource's data or imports
+bool YAP::addInputFile(QHash<uint64_t, InputFiles>& index, const QString& path)
+{
+	QString fileName = path.sliced(path.lastIndexOf('/') + 1);
+	QStringList InputFiles::* list = nullptr;
+	qsizetype suffixSize = 0;
+	// Longest suffixes first, since every data file ends in the default one
+	if (fileName.endsWith(primarySuffix))
+	{
+		list = &InputFiles::primary;
+		suffixSize = primarySuffix.size();
+	}
+	else if (fileName.endsWith(secondarySuffix))
+	{
+		list = &InputFiles::secondary;
+		suffixSize = secondarySuffix.size();
+	}
+	else if (fileName.endsWith(importsSuffix))
+	{
+		list = &InputFiles::imports;
+		suffixSize = importsSuffix.size();
+	}
+	else if (fileName.endsWith(defaultSuffix))
+	{
+		list = &InputFiles::primary;
+		suffixSize = defaultSuffix.size();
+	}
+	else
+		return false;
+
+	// Resource files are named with exactly 8 uppercase hex digits
+	if (fileName.size() - suffixSize != 8)
+		return false;
+	uint64_t id = 0;
+	for (qsizetype i = 0; i < 8; ++i)
+	{
+		char16_t c = fileName[i].unicode();
+		if (c >= '0' && c <= '9')
+			id = id << 4 | (c - '0');
+		else if (c >= 'A' && c <= 'F')
+			id = id << 4 | (c - 'A' + 10);
+		else
+			return false;
+	}
+	(index[id].*list).append(path);
+	return true;
+}
+
 bool YAP::validateMetadata()
 {
-	QFileInfo metaInfo(inPath + metadataFilename);
-	if (!metaInfo.exists() || !metaInfo.isFile() || !metaInfo.isReadable())
+	if (!inputReadable(inPath + metadataFilename))
 	{
 		qCritical().noquote() << "Metadata file could not be opened."
 			<< "Ensure the file" << metadataFilename << "exists in the directory specified"
@@ -209,7 +717,7 @@ bool YAP::validateMetadata()
 		return false;
 	}
 
-	YAML::Node meta = YAML::LoadFile((inPath + metadataFilename).toStdString());
+	YAML::Node meta = loadInputYaml(inPath + metadataFilename);
 	if (!meta.IsMap())
 	{
 		qCritical() << "Invalid metadata file: Expected root node type to be map.";
@@ -218,10 +726,13 @@ bool YAP::validateMetadata()
 
 	if (!validateBundleMetadata(meta))
 		return false;
+	if (inputFiles.isEmpty()) // Unless already walked when checking the index
+		indexInputFiles();
 	if (!validateResourceMetadata(meta))
 		return false;
-	if (!validateImports(meta))
+	if (!validateImports())
 		return false;
+	inputFiles.clear(); // Paths are in resourceFiles now
 
 	return true;
 }
@@ -256,7 +767,24 @@ bool YAP::validateBundleMetadata(YAML::Node& meta)
 		qCritical() << "Invalid bundle platform: Must be 1, 2, or 3.";
 		return false;
 	}
-	// Compressed and optimised flags checked during bundle creation
+	indexHeader = IndexHeader();
+	indexHeader.platform = platform;
+
+	auto readFlag = [&](const char* name, Bundle::Flags flag)
+	{
+		if (!meta["bundle"][name] || !meta["bundle"][name].IsScalar())
+		{
+			qWarning().noquote().nospace() << "Flag \"" << name << "\" is unspecified or invalid. Defaulting to true.";
+			indexHeader.flags |= (uint32_t)flag;
+		}
+		else if (meta["bundle"][name].as<bool>())
+		{
+			indexHeader.flags |= (uint32_t)flag;
+		}
+	};
+	readFlag("compressed", Bundle::Flags::IsCompressed);
+	readFlag("mainMemOptimised", Bundle::Flags::IsMainMemOptimised);
+	readFlag("graphicsMemOptimised", Bundle::Flags::IsGraphicsMemOptimised);
 	return true;
 }
 
@@ -273,6 +801,8 @@ bool YAP::validateResourceMetadata(YAML::Node& meta)
 		qCritical() << "Invalid metadata file: Expected resources node type to be map.";
 		return false;
 	}
+	resourceDescriptors.clear();
+	resourceDescriptors.reserve(meta["resources"].size());
 	int i = 0;
 	for (YAML::const_iterator resource = meta["resources"].begin();
 		resource != meta["resources"].end(); ++resource, ++i)
@@ -289,12 +819,15 @@ bool YAP::validateResourceMetadata(YAML::Node& meta)
 			return false;
 		//if (resourceHasDuplicateKey(meta["resources"], id, resource->first.as<std::string>()))
 		//	return false;
+		ResourceDescriptor descriptor;
+		descriptor.id = id;
 		if (!resource->second["type"] || !resource->second["type"].IsScalar())
 		{
 			qCritical().noquote().nospace() << "Resource " << resource->first.as<std::string>()
 				<< " does not specify a type or specifies an invalid type. Aborting.";
 			return false;
 		}
+		descriptor.type = resource->second["type"].as<uint32_t>();
 		if (resource->second["secondaryMemoryType"])
 		{
 			if (!resource->second["secondaryMemoryType"].IsScalar())
@@ -310,6 +843,7 @@ bool YAP::validateResourceMetadata(YAML::Node& meta)
 					<< ": Invalid secondary memory type specified; must be 1 or 2.";
 				return false;
 			}
+			descriptor.secondaryMemoryType = memType;
 		}
 		if (!resource->second["alignment"])
 		{
@@ -324,6 +858,7 @@ bool YAP::validateResourceMetadata(YAML::Node& meta)
 		}
 		else
 		{
+			int j = 0;
 			for (YAML::Node alignment : resource->second["alignment"])
 			{
 				if (!alignment.IsScalar())
@@ -337,37 +872,36 @@ bool YAP::validateResourceMetadata(YAML::Node& meta)
 					qWarning().nospace().noquote() << "Resource " << resource->first.as<std::string>()
 						<< ": Invalid alignment value (must be a power of 2 <=0x8000). Defaults will be used.";
 				}
+				else if (j < 2)
+					descriptor.alignment[j] = alignment.as<uint16_t>();
+				++j;
 			}
 		}
+		resourceDescriptors.append(descriptor);
 		resourceFiles.append({ "", "", "" });
-		QString idString = QString::number(id, 16).rightJustified(8, '0').toUpper();
-		QDirIterator it(inPath, QDirIterator::Subdirectories);
-		while (it.hasNext())
+		const InputFiles files = inputFiles.value(id);
+		if (files.primary.size() > 1) // Duplicate resource
+		{
+			qCritical().noquote().nospace() << "Resource " << resource->first.as<std::string>()
+				<< ": Primary portion has a duplicate file. Aborting.";
+			return false;
+		}
+		if (!files.primary.isEmpty())
 		{
-			if (it.nextFileInfo().fileName() == idString + defaultSuffix
-				|| it.fileInfo().fileName() == idString + primarySuffix)
+			const QString& path = files.primary.first();
+			if (!inputReadable(path))
 			{
-				if (!it.fileInfo().isFile() || !it.fileInfo().isReadable())
-				{
-					qCritical().noquote() << "Resource" << resource->first.as<std::string>()
-						<< "primary portion cannot be opened. Ensure it has the correct permissions set.";
-					return false;
-				}
-				if (it.fileInfo().size() == 0)
-				{
-					qCritical().noquote() << "Resource" << resource->first.as<std::string>()
-						<< "primary portion is 0 bytes in size. Aborting.";
-					return false;
-				}
-				if (!resourceFiles[i][0].isEmpty()) // Duplicate resource
-				{
-					qCritical().noquote().nospace() << "Resource " << resource->first.as<std::string>()
-						<< ": Primary portion has a duplicate file. Aborting.";
-					return false;
-				}
-				resourceFiles[i][0] = it.fileInfo().absoluteFilePath();
-				// Do not break so duplicates may be found
+				qCritical().noquote() << "Resource" << resource->first.as<std::string>()
+					<< "primary portion cannot be opened. Ensure it has the correct permissions set.";
+				return false;
+			}
+			if (inputSize(path) == 0)
+			{
+				qCritical().noquote() << "Resource" << resource->first.as<std::string>()
+					<< "primary portion is 0 bytes in size. Aborting.";
+				return false;
 			}
+			resourceFiles[i][0] = path;
 		}
 		if (resourceFiles[i][0].isEmpty())
 		{
@@ -378,20 +912,19 @@ bool YAP::validateResourceMetadata(YAML::Node& meta)
 		if (resourceFiles[i][0].endsWith(primarySuffix))
 		{
 			resourceFiles[i][1] = resourceFiles[i][0].chopped(primarySuffix.size()) + secondarySuffix;
-			QFileInfo secondaryInfo(resourceFiles[i][1]);
-			if (!secondaryInfo.exists())
+			if (!files.secondary.contains(resourceFiles[i][1]))
 			{
 				qCritical().noquote() << "Resource" << resource->first.as<std::string>()
 					<< "is missing its secondary data portion. Aborting.";
 				return false;
 			}
-			if (!secondaryInfo.isFile() || !secondaryInfo.isReadable())
+			if (!inputReadable(resourceFiles[i][1]))
 			{
 				qCritical().noquote() << "Resource" << resource->first.as<std::string>()
 					<< "secondary portion cannot be opened. Ensure it has the correct permissions set.";
 				return false;
 			}
-			if (secondaryInfo.size() == 0)
+			if (inputSize(resourceFiles[i][1]) == 0)
 			{
 				qCritical().noquote() << "Resource" << resource->first.as<std::string>()
 					<< "secondary portion is 0 bytes in size. Aborting.";
@@ -403,40 +936,57 @@ bool YAP::validateResourceMetadata(YAML::Node& meta)
 	return true;
 }
 
-bool YAP::validateImports(YAML::Node& meta)
+bool YAP::validateImports()
 {
 	// Imports are NOT guaranteed to exist, even if they should.
 	// Due to changes in development builds, they can't be fully validated.
 	// Leave that to the game and only check basic things here.
+	// Each resource's imports are parsed once into the import table, which
+	// creation then uses instead of the YAML. Files in the form extraction
+	// writes are scanned directly, and anything else is parsed as YAML.
+	importTable.clear();
 	bool usingCombinedFile = true;
-	QFileInfo importsFileInfo(inPath + importsFilename);
-	YAML::Node importsFile;
-	if (!importsFileInfo.exists())
+	bool scannedCombinedFile = false;
+	QHash<uint64_t, QList<ImportEntry>> scannedLists; // By resource ID
+	QHash<uint64_t, YAML::Node> combinedLists; // By resource ID, if not scanned
+	QByteArray importsText;
+	if (!inputExists(inPath + importsFilename))
 		usingCombinedFile = false;
 	else
 	{
-		if (!importsFileInfo.isFile() || !importsFileInfo.isReadable())
+		if (!inputReadable(inPath + importsFilename))
 		{
 			qCritical() << "Imports file cannot be opened."
 				<< "Ensure it has the correct permissions set.";
 			return false;
 		}
-		combinedImports = YAML::LoadFile(importsFileInfo.absoluteFilePath().toStdString());
-		importsFile = combinedImports;
+		importsText = readInput(inPath + importsFilename);
+		scannedCombinedFile = scanCombinedImports(importsText, scannedLists);
+	}
+	if (usingCombinedFile && !scannedCombinedFile)
+	{
+		YAML::Node importsFile = YAML::Load(std::string(importsText.constData(), importsText.size()));
 		if (!importsFile.IsMap())
 		{
 			qCritical() << "Expected imports node type to be map. Aborting.";
 			return false;
 		}
+		for (YAML::const_iterator importsList = importsFile.begin();
+			importsList != importsFile.end(); ++importsList)
+		{
+			uint64_t resId = 0;
+			if (!validateResourceIdKey(importsList->first.as<std::string>(), resId))
+				return false;
+			if (!combinedLists.contains(resId)) // First list wins
+				combinedLists.insert(resId, importsList->second);
+		}
 	}
-	int i = 0;
-	for (YAML::const_iterator resource = meta["resources"].begin();
-		resource != meta["resources"].end(); ++resource, ++i)
+	for (qsizetype i = 0; i < resourceDescriptors.size(); ++i)
 	{
-		std::cout << "\rValidating imports for resource " << i + 1 << "/" << meta["resources"].size();
-		YAML::Node resourceImports;
-		uint64_t id = 0;
-		stringToUInt(QString::fromStdString(resource->first.as<std::string>()), id, true); // ID already validated, don't check result
+		std::cout << "\rValidating imports for resource " << i + 1 << "/" << resourceDescriptors.size();
+		QList<ImportEntry> imports;
+		uint64_t id = resourceDescriptors[i].id;
+		std::string resourceKey = "0x" + QString::number(id, 16).rightJustified(8, '0').toUpper().toStdString();
 		if (!usingCombinedFile)
 		{
 			// Find imports file and determine whether it exists, then set it as per-resource imports
@@ -445,93 +995,98 @@ bool YAP::validateImports(YAML::Node& meta)
 				importsLocation = resourceFiles[i][0].chopped(primarySuffix.size()) + importsSuffix;
 			else // <ID>.dat
 				importsLocation = resourceFiles[i][0].chopped(defaultSuffix.size()) + importsSuffix;
-			importsFileInfo.setFile(importsLocation);
-			if (!importsFileInfo.exists())
+			if (!inputFiles.value(id).imports.contains(importsLocation))
 				continue;
-			if (!importsFileInfo.isFile() || !importsFileInfo.isReadable())
+			if (!inputReadable(importsLocation))
 			{
-				qCritical().noquote() << "Imports for resource" << resource->first.as<std::string>()
+				qCritical().noquote() << "Imports for resource" << resourceKey
 					<< "cannot be opened. Ensure it has the correct permissions set.";
 				return false;
 			}
-			resourceFiles[i][2] = importsFileInfo.absoluteFilePath();
-			importsFile = YAML::LoadFile(importsFileInfo.absoluteFilePath().toStdString());
-			resourceImports = importsFile;
+			resourceFiles[i][2] = importsLocation;
+			QByteArray importsText = readInput(importsLocation);
+			if (!scanImports(importsText, imports)
+				&& !parseImports(YAML::Load(std::string(importsText.constData(), importsText.size())), resourceKey, imports))
+				return false;
 		}
-		else
+		else if (scannedCombinedFile)
 		{
-			bool foundImportsList = false;
-			for (YAML::const_iterator importsList = importsFile.begin();
-				importsList != importsFile.end(); ++importsList)
-			{
-				uint64_t resId = 0;
-				if (!validateResourceIdKey(importsList->first.as<std::string>(), resId))
-					return false;
-				//if (resourceHasDuplicateKey(importsFile, resId, resource->first.as<std::string>()))
-				//	return false;
-				if (resId == id)
-				{
-					resourceImports = importsList->second;
-					foundImportsList = true;
-					break;
-				}
-			}
-			if (!foundImportsList)
+			if (!scannedLists.contains(id))
 				continue;
+			imports = scannedLists.value(id);
 		}
-		if (!resourceImports.IsSequence())
+		else
 		{
-			qCritical().noquote().nospace() << "Resource " << resource->first.as<std::string>()
-				<< ": Expected imports node type to be sequence.";
-			return false;
+			if (!combinedLists.contains(id))
+				continue;
+			if (!parseImports(combinedLists.value(id), resourceKey, imports))
+				return false;
 		}
-		for (YAML::const_iterator import = resourceImports.begin();
-			import != resourceImports.end(); ++import)
+		// Data existence has been verified at this point
+		qint64 dataSize = inputSize(resourceFiles[i][0]);
+		for (const ImportEntry& import : imports)
 		{
-			if (!import->IsMap())
-			{
-				qCritical().noquote().nospace() << "Resource " << resource->first.as<std::string>()
-					<< ": Expected import node type to be map.";
-				return false;
-			}
-			if (import->size() != 1)
-			{
-				qCritical().noquote().nospace() << "Resource " << resource->first.as<std::string>()
-					<< ": Only one import per offset is allowed.";
-				return false;
-			}
-			// Data existence has been verified at this point
-			QFileInfo dataFileInfo(resourceFiles[i][0]);
-			uint32_t importOffset = 0;
-			if (!stringToUInt<uint32_t>(QString::fromStdString(import->begin()->first.as<std::string>()), importOffset, true))
-				return false;
-			if (importOffset > dataFileInfo.size())
-			{
-				qCritical().noquote().nospace() << "Resource " << resource->first.as<std::string>()
-					<< ": Import offset " << import->begin()->first.as<std::string>() << " out of range. Aborting.";
-				return false;
-			}
-			//if (importHasDuplicateKey(resourceImports, importOffset, import->begin()->first.as<std::string>()))
-			//	return false;
-			if (!import->begin()->second.IsScalar())
-			{
-				qCritical().noquote().nospace() << "Resource " << resource->first.as<std::string>()
-					<< " import " << import->begin()->first.as<std::string>() << ": Expected node type to be scalar. Aborting.";
-				return false;
-			}
-			uint64_t importedResourceId = import->begin()->second.as<uint64_t>();
-			if (importedResourceId == 0 || importedResourceId > 0xFFFFFFFF)
+			if (import.offset > dataSize)
 			{
-				qCritical().noquote().nospace() << "Invalid imported resource ID " << QString::number(importedResourceId, 16)
-					<< " for resource " << resource->first.as<std::string>() << ". Aborting.";
+				qCritical().noquote().nospace() << "Resource " << resourceKey
+					<< ": Import offset 0x" << QString::number(import.offset, 16) << " out of range. Aborting.";
 				return false;
 			}
 		}
+		importTable.insert(id, imports);
 	}
 	std::cout << "\nAll imports validated successfully.\n";
 	return true;
 }
 
+// Reads one resource's list of imports, each a single offset mapped to an ID
+bool YAP::parseImports(const YAML::Node& resourceImports, const std::string& resourceKey, QList<ImportEntry>& imports)
+{
+	if (!resourceImports.IsSequence())
+	{
+		qCritical().noquote().nospace() << "Resource " << resourceKey
+			<< ": Expected imports node type to be sequence.";
+		return false;
+	}
+	imports.reserve(resourceImports.size());
+	for (YAML::const_iterator import = resourceImports.begin();
+		import != resourceImports.end(); ++import)
+	{
+		if (!import->IsMap())
+		{
+			qCritical().noquote().nospace() << "Resource " << resourceKey
+				<< ": Expected import node type to be map.";
+			return false;
+		}
+		if (import->size() != 1)
+		{
+			qCritical().noquote().nospace() << "Resource " << resourceKey
+				<< ": Only one import per offset is allowed.";
+			return false;
+		}
+		ImportEntry entry;
+		if (!stringToUInt<uint32_t>(QString::fromStdString(import->begin()->first.as<std::string>()), entry.offset, true))
+			return false;
+		//if (importHasDuplicateKey(resourceImports, importOffset, import->begin()->first.as<std::string>()))
+		//	return false;
+		if (!import->begin()->second.IsScalar())
+		{
+			qCritical().noquote().nospace() << "Resource " << resourceKey
+				<< " import " << import->begin()->first.as<std::string>() << ": Expected node type to be scalar. Aborting.";
+			return false;
+		}
+		entry.id = import->begin()->second.as<uint64_t>();
+		if (entry.id == 0 || entry.id > 0xFFFFFFFF)
+		{
+			qCritical().noquote().nospace() << "Invalid imported resource ID " << QString::number(entry.id, 16)
+				<< " for resource " << resourceKey << ". Aborting.";
+			return false;
+		}
+		imports.append(entry);
+	}
+	return true;
+}
+
 bool YAP::validateResourceIdKey(std::string resourceKey, uint64_t& id)
 {
 	QString key = QString::fromStdString(resourceKey);
@@ -592,17 +1147,51 @@ bool YAP::validateResourceIdKey(std::string resourceKey, uint64_t& id)
 
 void YAP::setShaderTypeName(GameDataStream& stream)
 {
-	// Already set to "Shader", only change if console version
+	// Reset as well as set since bundles for different platforms may be listed
 	if (stream.platform() != GameDataStream::Platform::PC)
 		resourceTypes[0x32] = "ShaderTechnique";
+	else
+		resourceTypes[0x32] = "Shader";
+}
+
+// Resolves a type given as a number or name. Some names are shared by more
+// than one type.
+bool YAP::resolveTypeString(const QString& typeString, QList<uint32_t>& types)
+{
+	uint32_t type = 0;
+	if (typeString.isEmpty())
+	{
+		qCritical() << "Empty resource type. Aborting.";
+		return false;
+	}
+	if (typeString.front().isDigit())
+	{
+		if (!stringToUInt<uint32_t>(typeString, type, true))
+			return false;
+		types.append(type);
+		return true;
+	}
+	for (auto it = resourceTypes.cbegin(); it != resourceTypes.cend(); ++it)
+	{
+		if (it.value().compare(typeString, Qt::CaseInsensitive) == 0)
+			types.append(it.key());
+	}
+	if (types.isEmpty())
+	{
+		qCritical().noquote().nospace() << "Unknown resource type " << typeString << ". Aborting.";
+		return false;
+	}
+	return true;
 }
 
 void YAP::createDecompressor()
 {
-	dc = libdeflate_alloc_decompressor();
+	if (dc == nullptr) // Batch jobs are given their thread's
+		dc = libdeflate_alloc_decompressor();
 }
 
 void YAP::createCompressor()
 {
-	cmp = libdeflate_alloc_compressor(9);
+	if (cmp == nullptr)
+		cmp = libdeflate_alloc_compressor(compressionLevel);
 }